@@ -0,0 +1,259 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ecs.h"
+
+// ECS costs through the public ECSManager / System<> API, no window or gpu is created
+// usage: nve_bench_ecs [results.json] [max entities]
+// a table goes to stdout, the json results to the given file or stdout after the table
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Position
+{
+    float x, y, z;
+};
+struct Velocity
+{
+    float x, y, z;
+};
+struct Health
+{
+    float value;
+};
+
+class MoveSystem final : public System<Position, Velocity>
+{
+public:
+    void update(float dt, EntityId entity) override
+    {
+        auto& position = m_ecs->get_component<Position>(entity);
+        const auto& velocity = m_ecs->read_component<Velocity>(entity);
+        position.x += velocity.x * dt;
+        position.y += velocity.y * dt;
+        position.z += velocity.z * dt;
+    }
+};
+
+struct BenchResult
+{
+    std::string name;
+    std::string storage;
+    size_t entities;
+    size_t ops;
+    double nsPerOp;
+};
+
+std::vector<BenchResult> g_results;
+
+// keeps the optimizer from dropping the reads
+volatile float g_sink;
+
+template<typename F>
+double ns_per_op(size_t ops, F&& f)
+{
+    auto start = Clock::now();
+    f();
+    auto end = Clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / static_cast<double>(ops);
+}
+
+void record(const char* name, ComponentStorageMode mode, size_t entities, size_t ops, double nsPerOp)
+{
+    const char* storage = mode == ComponentStorageMode::Archetypes ? "archetypes" : "lists";
+    g_results.push_back({ name, storage, entities, ops, nsPerOp });
+    printf("%-22s | %-10s | %10zu | %12.2f\n", name, storage, entities, nsPerOp);
+}
+
+std::unique_ptr<ECSManager> make_ecs(ComponentStorageMode mode)
+{
+    auto ecs = std::make_unique<ECSManager>(nullptr);
+    ecs->set_storage_mode(mode);
+    return ecs;
+}
+std::vector<EntityId> shuffled(std::vector<EntityId> entities, std::mt19937& rng)
+{
+    std::shuffle(entities.begin(), entities.end(), rng);
+    return entities;
+}
+
+// one entity at a time, like gameplay code spawning and despawning objects
+void bench_churn(ComponentStorageMode mode, size_t count, std::mt19937& rng)
+{
+    auto ecs = make_ecs(mode);
+    std::vector<EntityId> entities(count);
+
+    record("create_entity", mode, count, count, ns_per_op(count, [&]() {
+        for (size_t i = 0; i < count; i++)
+        {
+            entities[i] = ecs->create_entity();
+            ecs->add_component<Position>(entities[i]);
+            ecs->add_component<Velocity>(entities[i]);
+        }
+    }));
+    // the deletes happen in a later frame, pending awakes would be searched on every delete
+    ecs->update_systems(0.f);
+    auto order = shuffled(entities, rng);
+    record("delete_entity", mode, count, count, ns_per_op(count, [&]() {
+        for (EntityId entity : order)
+            ecs->delete_entity(entity);
+    }));
+
+    record("create_entities_bulk", mode, count, count, ns_per_op(count, [&]() {
+        entities = ecs->create_entities<Position, Velocity>(count);
+    }));
+    ecs->update_systems(0.f);
+    record("delete_entities_bulk", mode, count, count, ns_per_op(count, [&]() {
+        ecs->delete_entities(entities);
+    }));
+}
+
+void bench_add_remove(ComponentStorageMode mode, size_t count, std::mt19937& rng)
+{
+    auto ecs = make_ecs(mode);
+    auto order = shuffled(ecs->create_entities<Position>(count), rng);
+
+    record("add_component", mode, count, count, ns_per_op(count, [&]() {
+        for (EntityId entity : order)
+            ecs->add_component<Velocity>(entity);
+    }));
+    record("remove_component", mode, count, count, ns_per_op(count, [&]() {
+        for (EntityId entity : order)
+            ecs->remove_component<Velocity>(entity);
+    }));
+}
+
+void bench_get(ComponentStorageMode mode, size_t count, std::mt19937& rng)
+{
+    auto ecs = make_ecs(mode);
+    auto entities = ecs->create_entities<Position, Velocity>(count);
+    auto order = shuffled(entities, rng);
+
+    record("get_component_seq", mode, count, count, ns_per_op(count, [&]() {
+        float sum = 0;
+        for (EntityId entity : entities)
+            sum += ecs->get_component<Position>(entity).x += 1.f;
+        g_sink = sum;
+    }));
+    record("get_component_random", mode, count, count, ns_per_op(count, [&]() {
+        float sum = 0;
+        for (EntityId entity : order)
+            sum += ecs->get_component<Position>(entity).x += 1.f;
+        g_sink = sum;
+    }));
+    record("read_component_random", mode, count, count, ns_per_op(count, [&]() {
+        float sum = 0;
+        for (EntityId entity : order)
+            sum += ecs->read_component<Position>(entity).x;
+        g_sink = sum;
+    }));
+}
+
+// cost per system entity update, one frame after the entities got awoken
+void bench_update(ComponentStorageMode mode, size_t count, size_t systemCount)
+{
+    auto ecs = make_ecs(mode);
+    std::vector<MoveSystem> systems(systemCount);
+    for (auto& system : systems)
+        ecs->register_system<MoveSystem>(&system);
+    ecs->create_entities<Position, Velocity>(count, [](Position& position, Velocity& velocity) { velocity = { 1.f, 2.f, 3.f }; });
+    ecs->update_systems(0.01f);
+
+    std::string name = "update_systems_" + std::to_string(systemCount);
+    size_t ops = count * systemCount;
+    record(name.c_str(), mode, count, ops, ns_per_op(ops, [&]() {
+        ecs->update_systems(0.01f);
+    }));
+}
+
+// every other entity has a Health, so the 3 component join matches half of them
+void bench_join(ComponentStorageMode mode, size_t count)
+{
+    auto ecs = make_ecs(mode);
+    auto entities = ecs->create_entities<Position, Velocity>(count);
+    for (size_t i = 0; i < count; i += 2)
+        ecs->add_component<Health>(entities[i]);
+
+    auto& join2 = ecs->view<Position, const Velocity>();
+    auto& join3 = ecs->view<Position, const Velocity, const Health>();
+
+    record("join_2", mode, count, count, ns_per_op(count, [&]() {
+        join2.each([](Position& position, const Velocity& velocity) { position.x += velocity.x; });
+    }));
+    record("join_3", mode, count, count / 2, ns_per_op(count / 2, [&]() {
+        join3.each([](Position& position, const Velocity& velocity, const Health& health) { position.x += velocity.x * health.value; });
+    }));
+    if (mode == ComponentStorageMode::Archetypes)
+    {
+        record("join_2_chunks", mode, count, count, ns_per_op(count, [&]() {
+            ecs->for_each_chunk<Position, Velocity>([](size_t chunkSize, EntityId* chunkEntities, Position* positions, Velocity* velocities) {
+                for (size_t i = 0; i < chunkSize; i++)
+                    positions[i].x += velocities[i].x;
+            });
+        }));
+    }
+}
+
+void write_json(FILE* file)
+{
+    fprintf(file, "{\n  \"benchmark\": \"nve_bench_ecs\",\n  \"unit\": \"ns_per_op\",\n  \"results\": [\n");
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const auto& result = g_results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"storage\": \"%s\", \"entities\": %zu, \"ops\": %zu, \"ns_per_op\": %.3f }%s\n",
+            result.name.c_str(), result.storage.c_str(), result.entities, result.ops, result.nsPerOp, i + 1 < g_results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* jsonPath = argc > 1 ? argv[1] : nullptr;
+    size_t maxEntities = argc > 2 ? std::stoull(argv[2]) : 1000000;
+
+    const size_t counts[] = { 1000, 10000, 100000, 1000000 };
+    const size_t systemCounts[] = { 1, 10, 50 };
+    const ComponentStorageMode modes[] = { ComponentStorageMode::ComponentLists, ComponentStorageMode::Archetypes };
+    std::mt19937 rng(42);
+
+    printf("%-22s | %-10s | %10s | %12s\n", "benchmark", "storage", "entities", "ns/op");
+    for (size_t count : counts)
+    {
+        if (count > maxEntities)
+            break;
+        for (auto mode : modes)
+        {
+            bench_churn(mode, count, rng);
+            bench_add_remove(mode, count, rng);
+            bench_get(mode, count, rng);
+            for (size_t systemCount : systemCounts)
+                bench_update(mode, count, systemCount);
+            bench_join(mode, count);
+        }
+    }
+
+    if (jsonPath)
+    {
+        FILE* file = fopen(jsonPath, "w");
+        if (!file)
+        {
+            fprintf(stderr, "can't open %s\n", jsonPath);
+            return 1;
+        }
+        write_json(file);
+        fclose(file);
+    }
+    else
+    {
+        write_json(stdout);
+    }
+
+    return 0;
+}
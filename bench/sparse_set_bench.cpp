@@ -0,0 +1,120 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "ecs/sparse_set.h"
+
+// compares the paged sparse set against the std::unordered_map previously used by ComponentList
+// keys are dense ids like the ones handed out by ECSManager, accessed in random order
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct BenchResult
+{
+    double add;
+    double get;
+    double remove;
+};
+
+template<typename F>
+double ns_per_op(size_t ops, F&& f)
+{
+    auto start = Clock::now();
+    f();
+    auto end = Clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / static_cast<double>(ops);
+}
+
+// keeps the optimizer from dropping the lookups
+volatile size_t g_sink;
+
+BenchResult bench_map(const std::vector<uint32_t>& keys, const std::vector<uint32_t>& order)
+{
+    std::unordered_map<uint32_t, size_t> map;
+    BenchResult result = {};
+
+    result.add = ns_per_op(keys.size(), [&]() {
+        for (size_t i = 0; i < keys.size(); i++)
+            map[keys[i]] = i;
+    });
+    result.get = ns_per_op(order.size(), [&]() {
+        size_t sum = 0;
+        for (uint32_t key : order)
+            sum += map[key];
+        g_sink = sum;
+    });
+    result.remove = ns_per_op(order.size(), [&]() {
+        for (uint32_t key : order)
+            map.erase(key);
+    });
+
+    return result;
+}
+
+BenchResult bench_sparse_set(const std::vector<uint32_t>& keys, const std::vector<uint32_t>& order)
+{
+    SparseSet set;
+    BenchResult result = {};
+
+    result.add = ns_per_op(keys.size(), [&]() {
+        for (uint32_t key : keys)
+            set.insert(key);
+    });
+    result.get = ns_per_op(order.size(), [&]() {
+        size_t sum = 0;
+        for (uint32_t key : order)
+            sum += set.index(key);
+        g_sink = sum;
+    });
+    result.remove = ns_per_op(order.size(), [&]() {
+        for (uint32_t key : order)
+            set.erase(key);
+    });
+
+    return result;
+}
+
+// the first run of each structure pays for page faults of fresh memory, so keep the best one
+const int BenchRuns = 3;
+
+template<typename F>
+BenchResult best_of(int runs, F&& bench)
+{
+    BenchResult best = bench();
+    for (int i = 1; i < runs; i++)
+    {
+        BenchResult result = bench();
+        best.add = std::min(best.add, result.add);
+        best.get = std::min(best.get, result.get);
+        best.remove = std::min(best.remove, result.remove);
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t counts[] = { 10000, 100000, 1000000 };
+    std::mt19937 rng(42);
+
+    printf("%10s | %-14s | %10s | %10s | %10s\n", "entities", "structure", "add ns/op", "get ns/op", "remove ns/op");
+    for (size_t count : counts)
+    {
+        std::vector<uint32_t> keys(count);
+        std::iota(keys.begin(), keys.end(), 0);
+        std::vector<uint32_t> order = keys;
+        std::shuffle(order.begin(), order.end(), rng);
+
+        BenchResult map = best_of(BenchRuns, [&]() { return bench_map(keys, order); });
+        BenchResult set = best_of(BenchRuns, [&]() { return bench_sparse_set(keys, order); });
+
+        printf("%10zu | %-14s | %10.2f | %10.2f | %10.2f\n", count, "unordered_map", map.add, map.get, map.remove);
+        printf("%10zu | %-14s | %10.2f | %10.2f | %10.2f\n", count, "sparse set", set.add, set.get, set.remove);
+    }
+
+    return 0;
+}
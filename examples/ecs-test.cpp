@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#include "ecs.h"
+
+// checks of ECSManager edge cases, returns the number of failed checks
+
+struct TestComponent
+{
+    int value;
+};
+
+int g_failed = 0;
+
+void check(bool condition, const char* name)
+{
+    if (!condition)
+    {
+        printf("failed: %s\n", name);
+        g_failed++;
+    }
+}
+
+void test_double_delete()
+{
+    ECSManager ecs(nullptr);
+
+    EntityId a = ecs.create_entity();
+    EntityHandle handle = ecs.handle(a);
+    ecs.add_component<TestComponent>(a);
+    ecs.delete_entity(a);
+    ecs.delete_entity(a);
+    check(!ecs.valid(handle), "handle of a deleted entity is invalid");
+
+    // the id was freed once, so it can't be handed out twice
+    EntityId b = ecs.create_entity();
+    EntityId c = ecs.create_entity();
+    check(b != c, "double delete_entity frees the id once");
+
+    ecs.delete_entities({ b, b });
+    ecs.delete_entities({ b });
+    EntityId d = ecs.create_entity();
+    EntityId e = ecs.create_entity();
+    check(d != e && d != c && e != c, "double delete_entities frees the id once");
+}
+
+// a component which existed before the batch and is gone after it is reported as removed, whatever happened in between
+void test_removal_netting()
+{
+    ECSManager ecs(nullptr);
+
+    size_t added = 0;
+    size_t removed = 0;
+    ecs.on_add<TestComponent>([&](std::span<const EntityId> entities) { added += entities.size(); });
+    ecs.on_remove<TestComponent>([&](std::span<const EntityId> entities) { removed += entities.size(); });
+
+    EntityId a = ecs.create_entity();
+    ecs.add_component<TestComponent>(a);
+    ecs.update_systems(0.f);
+    check(added == 1 && removed == 0, "a new component is reported as added");
+
+    added = 0;
+    ecs.remove_component<TestComponent>(a);
+    ecs.add_component<TestComponent>(a);
+    ecs.remove_component<TestComponent>(a);
+    ecs.update_systems(0.f);
+    check(added == 0 && removed == 1, "remove, add and remove is reported as removed");
+
+    removed = 0;
+    ecs.add_component<TestComponent>(a);
+    ecs.update_systems(0.f);
+    added = 0;
+    ecs.delete_entity(a);
+    EntityId b = ecs.create_entity();
+    ecs.add_component<TestComponent>(b);
+    ecs.delete_entity(b);
+    ecs.update_systems(0.f);
+    check(b == a && added == 0 && removed == 1, "delete, recycle and delete is reported as removed");
+}
+
+int main()
+{
+    test_double_delete();
+    test_removal_netting();
+
+    if (g_failed == 0)
+        printf("all checks passed\n");
+    return g_failed;
+}
@@ -156,6 +156,7 @@ int main(int argc, char** argv)
 
       // Position Based Dynamics
       PBDSystem pbd;
+      pbd.set_threads(static_cast<int>(std::thread::hardware_concurrency()));
       renderer.m_ecs.register_system<PBDSystem>(&pbd);
 
       auto boundary = renderer.m_ecs.create_entity();
@@ -191,9 +192,8 @@ int main(int argc, char** argv)
                   pbdParticle.radius = particleRadius;
                   auto& transform = renderer.m_ecs.add_component<Transform>(particle);
 
-                  auto constraint = pbd.add_constraint<CollisionConstraint>({ particle, boundary });
-                  constraint->m_distance = boundingParticleRadius;
-                  constraint->m_compliance = 0.f;
+                  const EntityId pair[] = { particle, boundary };
+                  pbd.constraint_batch<CollisionKind, 2>().add_persistent(pair, { boundingParticleRadius }, InverseInequality, 0.f);
                   renderer.m_ecs.add_component<DynamicModel>(particle) = ball;
                   renderer.m_ecs.get_component<DynamicModel>(particle).m_children.front().material = std::make_shared<Material>();
 
@@ -341,6 +341,10 @@ int main(int argc, char** argv)
 
                   ImGui::SliderInt("Solver Steps", &pbd.m_solverIterations, 1, 10);
                   ImGui::SliderInt("Substeps", &pbd.m_substeps, 1, 10);
+                  ImGui::SliderFloat("Neighbor Skin", &pbd.m_neighborSkin, 0.f, 2.f);
+                  bool coloredSolver = pbd.m_solverMode == PBDSolverMode::GraphColoring;
+                  if (ImGui::Checkbox("Graph Colored Solver", &coloredSolver))
+                        pbd.m_solverMode = coloredSolver ? PBDSolverMode::GraphColoring : PBDSolverMode::Jacobi;
 
                   ImGui::SliderFloat("speed", &moveSpeed, 0.f, 4.f);
                   ImGui::SliderFloat("sensitivity", &turningSpeed, 0.f, 0.5f);
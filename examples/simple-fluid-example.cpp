@@ -151,20 +151,22 @@ int main(int argc, char** argv)
     {
         int width = (int)sqrt(particleCount);
         float downScale = fminf(SF_BOUNDING_WIDTH, SF_BOUNDING_HEIGHT) / width / 1.5f;
-        for (int i = particles.size(); i < particleCount; i++)
-        {
-            EntityId id = renderer.m_ecs.create_entity();
-            auto& part = renderer.m_ecs.add_component<Particle>(id);
-            renderer.m_ecs.add_component<DynamicModel>(id) = ball;
-            auto& transform = renderer.m_ecs.add_component<Transform>(id);
-            transform.scale = Vector3(0.05f);
-
-            int x = i % (width)-width / 2;
-            int y = (int)i / width - width / 2;
-            part.position = { x * downScale, y * downScale};
-
-            particles.push_back(id);
-        }
+        if (particleCount <= (int)particles.size())
+            return;
+
+        int i = particles.size();
+        auto created = renderer.m_ecs.create_entities<Particle, DynamicModel, Transform>(particleCount - particles.size(),
+            [&](Particle& part, DynamicModel& model, Transform& transform)
+            {
+                model = ball;
+                transform.scale = Vector3(0.05f);
+
+                int x = i % (width)-width / 2;
+                int y = (int)i / width - width / 2;
+                part.position = { x * downScale, y * downScale};
+                i++;
+            });
+        particles.insert(particles.end(), created.begin(), created.end());
     };
     generate_particles();
 
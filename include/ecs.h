@@ -3,15 +3,23 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
 #include <iostream>
-#include <queue>
+#include <span>
+#include <string_view>
 #include <unordered_map>
+#include <memory>
+#include <mutex>
 #include <tuple>
+#include <type_traits>
+#include <typeindex>
 #include <vector>
 
 #include "space_consistent_vector.h"
 #include "profiler.h"
+#include "thread_pool.h"
 
 #define PROFILE_ECS
 #ifdef PROFILE_ECS
@@ -33,7 +41,7 @@ class ECSManager;
 class Renderer;
 
 #ifndef ECS_START_ENTITIES
-#define ECS_START_ENTITIES 5000
+#define ECS_START_ENTITIES 5000 // entity slots reserved up front
 #endif
 
 #ifndef ECS_MAX_COMPONENTS
@@ -41,63 +49,199 @@ class Renderer;
 #endif
 
 typedef uint32_t EntityId;
+typedef uint32_t EntityGeneration;
 typedef uint32_t ComponentTypeId;
 typedef uint32_t SystemId;
 
+// entity id tagged with the generation of its slot
+// ids get recycled after deletion, but a handle to a deleted entity never becomes valid again
+struct EntityHandle
+{
+	EntityId id;
+	EntityGeneration generation;
+
+	bool operator==(const EntityHandle& other) const = default;
+};
+
 #include "gui.h"
+#include "ecs/allocator.h"
+#include "ecs/snapshot.h"
+#include "ecs/archetype.h"
+#include "ecs/sparse_set.h"
+#include "ecs/observer.h"
+
+// every component type gets a process wide id on its first use, so lookups are plain array indices
+inline std::vector<const char*>& component_type_names() // indexed by ComponentTypeId
+{
+	static std::vector<const char*> s_names;
+	return s_names;
+}
+inline ComponentTypeId register_component_type(const char* typeName)
+{
+	auto& names = component_type_names();
+	assert(names.size() < ECS_MAX_COMPONENTS);
+	names.push_back(typeName);
+	return static_cast<ComponentTypeId>(names.size() - 1);
+}
+template<typename T>
+ComponentTypeId component_type_id()
+{
+	static const ComponentTypeId id = register_component_type(typeid(T).name());
+	return id;
+}
 
 class IComponentList
 {
 public:
+	virtual ~IComponentList() = default;
 	virtual void gui_show_component(EntityId entity) = 0;
 	virtual std::string print_type() = 0;
-	virtual void remove(EntityId entity) = 0;
+	// removes the component, entities whose components moved are appended to relocated
+	virtual void remove(EntityId entity, std::vector<EntityId>& relocated) = 0;
+	// adds a copy of the component value to every entity
+	virtual void add_copies(std::span<const EntityId> entities, const void* value) = 0;
+	virtual ComponentAllocationStats allocation_stats() const = 0;
+
+	// snapshots, only trivially copyable components are written and restored
+	virtual bool snapshot_supported() const = 0;
+	virtual void write_snapshot(EcsSnapshotWriter& writer, EcsSnapshotComponent& section) = 0;
+	// fills the empty list with the section, the caller checked it against the type, false if T isn't trivially copyable
+	virtual bool restore_snapshot(const std::shared_ptr<MappedFile>& file, const EcsSnapshotComponent& section) = 0;
 };
 
 template<typename T>
 class ComponentList : public IComponentList
 {
 public:
+	ComponentList() :
+		m_pool{ SPACE_CONSISTENT_VECTOR_RANGE_SIZE * sizeof(T), std::max<size_t>(SPACE_CONSISTENT_VECTOR_ALIGNMENT, alignof(T)) },
+		m_components{ PoolRangeAllocator{ &m_pool } }
+	{}
+
 	void add(EntityId entity)
 	{
-		//assert(!m_entityToIndex.contains(entity));
-
-		m_entityToIndex[entity] = m_components.size();
+		m_index.insert(entity);
 		m_components.push_back(T());
-		m_entities.push_back(entity);
 	}
-	void remove(EntityId entity) override
+	void reserve(size_t size)
 	{
-		//assert(m_entityToIndex.contains(entity));
-
-		size_t index = m_entityToIndex[entity];
+		m_index.reserve(size);
+		m_components.reserve(size);
+	}
+	void add_copies(std::span<const EntityId> entities, const void* value) override
+	{
+		const T& prototype = *static_cast<const T*>(value);
+		reserve(size() + entities.size());
+		for (EntityId entity : entities)
+		{
+			m_index.insert(entity);
+			if constexpr (std::is_trivially_copyable_v<T>)
+				m_components.append(&prototype, 1);
+			else
+				m_components.push_back(prototype);
+		}
+	}
+	size_t size() const
+	{
+		return m_index.size();
+	}
+	void remove(EntityId entity, std::vector<EntityId>& relocated) override
+	{
+		uint32_t index = m_index.erase(entity);
+		if (index == SparseSet::Null)
+			return;
 		m_components[index] = m_components.back();
 		m_components.pop_back();
-		m_entityToIndex[m_entities.back()] = index;
-		m_entityToIndex.erase(entity);
-		m_entities[index] = m_entities.back();
-		m_entities.pop_back();
+		if (index < m_index.size())
+			relocated.push_back(m_index[index]);
 	}
 	T& get(EntityId entity)
 	{
-		//assert(m_entityToIndex.contains(entity));
-
-		return m_components[m_entityToIndex[entity]];
+		return m_components[m_index.index(entity)];
 	}
 
 	void gui_show_component(EntityId entity) override
 	{
 		gui_print_component<T> g;
-		g(m_components[entity]);
+		g(get(entity));
 	}
 	std::string print_type() override
 	{
 		return typeid(T).name();
 	}
+	ComponentAllocationStats allocation_stats() const override
+	{
+		return { m_pool.reserved_bytes(), m_index.size() * sizeof(T) };
+	}
+
+	bool snapshot_supported() const override
+	{
+		return std::is_trivially_copyable_v<T>;
+	}
+	void write_snapshot(EcsSnapshotWriter& writer, EcsSnapshotComponent& section) override
+	{
+		if constexpr (std::is_trivially_copyable_v<T>)
+		{
+			section.elementSize = sizeof(T);
+			section.count = size();
+			section.rangeStride = m_pool.block_size();
+
+			writer.align(alignof(EntityId));
+			section.entitiesOffset = writer.offset();
+			writer.write(m_index.dense().data(), size() * sizeof(EntityId));
+
+			// every range is written like it sits in the pool, padding included
+			writer.align(std::max<size_t>(ECS_SNAPSHOT_ALIGNMENT, alignof(T)));
+			section.dataOffset = writer.offset();
+			m_components.for_each_range([&](std::span<const T> range)
+			{
+				writer.write(range.data(), range.size_bytes());
+				writer.pad(section.rangeStride - range.size_bytes());
+			});
+		}
+	}
+	bool restore_snapshot(const std::shared_ptr<MappedFile>& file, const EcsSnapshotComponent& section) override
+	{
+		if constexpr (std::is_trivially_copyable_v<T>)
+		{
+			// the layout and the ranges of the section were checked by ECSManager::load_snapshot
+			size_t ranges = (section.count + SPACE_CONSISTENT_VECTOR_RANGE_SIZE - 1) / SPACE_CONSISTENT_VECTOR_RANGE_SIZE;
+			assert(section.elementSize == sizeof(T) && file->contains(section.dataOffset, ranges * section.rangeStride));
+			assert(size() == 0);
+
+			const EntityId* entities = reinterpret_cast<const EntityId*>(file->data() + section.entitiesOffset);
+			m_index.reserve(section.count);
+			for (size_t i = 0; i < section.count; i++)
+				m_index.insert(entities[i]);
+
+			std::byte* data = file->data() + section.dataOffset;
+			if (section.rangeStride == m_pool.block_size() && reinterpret_cast<uintptr_t>(data) % std::max<size_t>(SPACE_CONSISTENT_VECTOR_ALIGNMENT, alignof(T)) == 0)
+			{
+				// zero copy, the ranges of the mapping become the storage and are recycled through the pool once freed
+				std::vector<T*> adopted(ranges);
+				for (size_t range = 0; range < ranges; range++)
+					adopted[range] = reinterpret_cast<T*>(data + range * section.rangeStride);
+				m_components.adopt_ranges(adopted, section.count);
+				m_pool.adopt_blocks(ranges);
+				m_mappings.push_back(file);
+			}
+			else
+			{
+				for (size_t range = 0; range < ranges; range++)
+				{
+					size_t start = range * SPACE_CONSISTENT_VECTOR_RANGE_SIZE;
+					m_components.append(reinterpret_cast<const T*>(data + range * section.rangeStride), std::min<size_t>(SPACE_CONSISTENT_VECTOR_RANGE_SIZE, section.count - start));
+				}
+			}
+			return true;
+		}
+		return false;
+	}
 private:
-	space_consistent_vector<T> m_components;
-	std::unordered_map<EntityId, size_t> m_entityToIndex;
-	std::vector<EntityId> m_entities; // basically a index -> entity map
+	std::vector<std::shared_ptr<MappedFile>> m_mappings; // snapshots whose ranges were adopted, declared first so they outlive the pool
+	ComponentPool m_pool; // ranges of m_components, declared before them so it outlives them
+	space_consistent_vector<T, PoolRangeAllocator> m_components;
+	SparseSet m_index; // entity -> component index, the dense side is the index -> entity map
 };
 
 template<typename T>
@@ -106,13 +250,18 @@ ComponentList<T>* construct_component_list()
 	return new ComponentList<T>();
 }
 
+#include "ecs/prefab.h"
+
 class ComponentManager
 {
 public:
 	ComponentManager() : 
-		m_newComponentId{ 0 }
+		m_storageMode{ ComponentStorageMode::ComponentLists }, m_changeTick{ 1 }, m_eventTick{ 0 }
 	{
-
+		// fixed size, so concurrently updated systems can look up lists while another one is created
+		m_components.resize(ECS_MAX_COMPONENTS, nullptr);
+		m_changeTicks.resize(ECS_MAX_COMPONENTS);
+		m_events = std::make_unique<ComponentEventQueue[]>(ECS_MAX_COMPONENTS);
 	}
 	~ComponentManager()
 	{
@@ -122,108 +271,330 @@ public:
 	}
 	template<typename T> void ensure_component()
 	{
-		const char* typeName = typeid(T).name();
-		ensure_component(typeName);
-
-		auto id = type_to_id(typeName);
-		if (m_components.size() <= id)
+		auto id = component_type_id<T>();
+		if (m_components[id] == nullptr)
 		{
-			m_components.reserve(id);
-			while (m_components.size() < id)
-				m_components.push_back(0);
-			m_components.push_back(construct_component_list<T>());
-		}
-		else if (m_components[id] == nullptr)
 			m_components[id] = construct_component_list<T>();
-	}
-	void ensure_component(const char* typeName)
-	{
-		if (!m_typeToId.contains(typeName))
-		{
-			m_typeToId[typeName] = m_newComponentId;
-			m_newComponentId++;
+			m_archetypeStorage.register_component<T>(id);
 		}
 	}
 	template<typename T> void add_component(EntityId entity)
 	{
 		ensure_component<T>();
 
-		const char* typeName = typeid(T).name();
+		ComponentTypeId id = component_type_id<T>();
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			m_archetypeStorage.add_component(entity, id, m_relocated);
+		else
+			list<T>(id)->add(entity);
+		entity_components(entity).set(id, true);
+		added(id, entity);
+	}
+	// adds all Cs at once, with archetypes the entity moves into its final archetype directly
+	template<typename... Cs> void add_components(EntityId entity)
+	{
+		(ensure_component<Cs>(), ...);
+
+		std::bitset<ECS_MAX_COMPONENTS> components;
+		(components.set(component_type_id<Cs>(), true), ...);
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			m_archetypeStorage.add_components(entity, components, m_relocated);
+		else
+			(list<Cs>(component_type_id<Cs>())->add(entity), ...);
+		entity_components(entity) |= components;
+		(added(component_type_id<Cs>(), entity), ...);
+	}
+	// adds the components of the prefab to all entities, which must not have any of them yet
+	void add_prefab(std::span<const EntityId> entities, const Prefab& prefab)
+	{
+		for (const auto& component : prefab.components())
+			component.ensure(*this);
+
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+		{
+			for (EntityId entity : entities)
+			{
+				m_archetypeStorage.add_components(entity, prefab.signature(), m_relocated);
+				for (const auto& component : prefab.components())
+				{
+					void* dst = m_archetypeStorage.get(entity, component.id);
+					if (component.trivial)
+						std::memcpy(dst, component.value.get(), component.size);
+					else
+						component.copy(dst, component.value.get());
+				}
+			}
+		}
+		else
+		{
+			for (const auto& component : prefab.components())
+				m_components[component.id]->add_copies(entities, component.value.get());
+		}
 
-		ComponentTypeId id = type_to_id(typeName);
-		list<T>(id)->add(entity);
-		m_entityComponents[entity].set(id, true);
+		for (EntityId entity : entities)
+		{
+			entity_components(entity) |= prefab.signature();
+			for (const auto& component : prefab.components())
+				added(component.id, entity);
+		}
+	}
+	// makes room for count more entities with all Cs
+	template<typename... Cs> void reserve_components(size_t count)
+	{
+		(ensure_component<Cs>(), ...);
+		if (m_storageMode == ComponentStorageMode::ComponentLists)
+			(list<Cs>(component_type_id<Cs>())->reserve(list<Cs>(component_type_id<Cs>())->size() + count), ...);
 	}
 	template<typename T> void remove_component(EntityId entity)
 	{
-		const char* typeName = typeid(T).name();
-		auto id = type_to_id(typeName);
-		list<T>(id)->remove(entity);
+		auto id = component_type_id<T>();
+		if (m_entityComponents.size() <= entity || !m_entityComponents[entity].test(id))
+			return;
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			m_archetypeStorage.remove_component(entity, id, m_relocated);
+		else
+			list<T>(id)->remove(entity, m_relocated);
 		m_entityComponents[entity].set(id, false);
+		if (m_events[id].records_membership())
+			m_events[id].record(ComponentEvent::Removed, entity);
 	}
 	template<typename T> T& get_component(EntityId entity)
 	{
-		const char* typeName = typeid(T).name();
-
-		auto id = type_to_id(typeName);
+		auto id = component_type_id<T>();
 		////assert(m_entityComponents[entity].test(id));
 
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			return *static_cast<T*>(m_archetypeStorage.get(entity, id));
 		return list<T>(id)->get(entity);
 	}
 	std::bitset<ECS_MAX_COMPONENTS> used_components(EntityId entity)
 	{
-		if (!m_entityComponents.contains(entity))
+		if (m_entityComponents.size() <= entity)
 			return std::bitset<ECS_MAX_COMPONENTS>();
 		return m_entityComponents[entity];
 	}
 
 	void remove_entity(EntityId entity)
 	{
+		if (m_entityComponents.size() <= entity)
+			return;
+
 		auto components = m_entityComponents[entity];
-		for (size_t i = 0; i < components.size(); i++)
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+		{
+			m_archetypeStorage.remove_entity(entity, m_relocated);
+		}
+		else
 		{
-			if (components.test(i))
+			for (size_t i = 0; i < components.size(); i++)
 			{
-				m_components[i]->remove(entity);
+				if (components.test(i))
+				{
+					m_components[i]->remove(entity, m_relocated);
+				}
 			}
 		}
-		m_entityComponents.erase(entity);
+		m_entityComponents[entity].reset();
+
+		for (size_t i = 0; i < components.size(); i++)
+			if (components.test(i) && m_events[i].records_membership())
+				m_events[i].record(ComponentEvent::Removed, entity);
 	}
 
-	ComponentTypeId type_to_id(const char* typeName)
+	// the storage mode can only be changed as long as no components exist
+	void set_storage_mode(ComponentStorageMode mode)
+	{
+		assert(std::none_of(m_entityComponents.begin(), m_entityComponents.end(), [](const auto& components) { return components.any(); }));
+		m_storageMode = mode;
+	}
+	ComponentStorageMode storage_mode() const
 	{
-		////assert(m_typeToId.contains(typeName));
-		if (typeName == m_lastTypeToIdStr)
-			return m_lastTypeToIdId;
-		ComponentTypeId id = m_typeToId[typeName];
-		m_lastTypeToIdId = id;
-		m_lastTypeToIdStr = typeName;
-		return id;
+		return m_storageMode;
+	}
+	template<typename... Ts, typename F> void for_each_chunk(F&& fn)
+	{
+		(ensure_component<Ts>(), ...);
+		m_archetypeStorage.for_each_chunk<Ts...>({ component_type_id<Ts>()... }, fn);
+	}
+	// change detection, mutable accesses through the ECSManager stamp components with the current tick
+	uint32_t change_tick() const
+	{
+		return m_changeTick;
+	}
+	void advance_change_tick()
+	{
+		m_changeTick++;
+	}
+	// systems of one parallel level which both only read T still get it mutably, so the ticks are accessed atomically
+	template<typename T> void mark_changed(EntityId entity)
+	{
+		ComponentTypeId id = component_type_id<T>();
+		uint32_t previous = std::atomic_ref<uint32_t>(m_changeTicks[id][entity]).exchange(m_changeTick, std::memory_order_relaxed);
+		// only the first change since the last event delivery is recorded
+		if (m_events[id].observes(ComponentEvent::Changed) && static_cast<int32_t>(previous - m_eventTick) <= 0)
+			m_events[id].record_changed(entity);
+	}
+	// the component was added or mutably accessed after the tick, wrap around safe
+	template<typename T> bool changed_since(EntityId entity, uint32_t tick) const
+	{
+		uint32_t& changed = const_cast<uint32_t&>(m_changeTicks[component_type_id<T>()][entity]);
+		return static_cast<int32_t>(std::atomic_ref<uint32_t>(changed).load(std::memory_order_relaxed) - tick) > 0;
+	}
+
+	// memory of one component type, in the active storage mode
+	ComponentAllocationStats allocation_stats(ComponentTypeId id) const
+	{
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			return m_archetypeStorage.allocation_stats(id);
+		if (m_components[id] == nullptr)
+			return { 0, 0 };
+		return m_components[id]->allocation_stats();
+	}
+
+	// appends a section for every trivially copyable component list, the storage mode has to be ComponentLists
+	void write_snapshot(EcsSnapshotWriter& writer, std::vector<EcsSnapshotComponent>& sections)
+	{
+		assert(m_storageMode == ComponentStorageMode::ComponentLists);
+		const auto& names = component_type_names();
+		for (ComponentTypeId id = 0; id < names.size(); id++)
+		{
+			if (m_components[id] == nullptr || !m_components[id]->snapshot_supported())
+				continue;
+
+			EcsSnapshotComponent section = {};
+			section.nameOffset = writer.offset();
+			section.nameLength = std::strlen(names[id]);
+			writer.write(names[id], section.nameLength);
+			m_components[id]->write_snapshot(writer, section);
+			sections.push_back(section);
+		}
+	}
+	// the component list of id has to exist and be empty, the section is checked by load_snapshot
+	bool restore_snapshot(ComponentTypeId id, const std::shared_ptr<MappedFile>& file, const EcsSnapshotComponent& section)
+	{
+		assert(m_storageMode == ComponentStorageMode::ComponentLists);
+		if (!m_components[id]->restore_snapshot(file, section))
+			return false;
+
+		const EntityId* entities = reinterpret_cast<const EntityId*>(file->data() + section.entitiesOffset);
+		for (size_t i = 0; i < section.count; i++)
+		{
+			entity_components(entities[i]).set(id, true);
+			added(id, entities[i]);
+		}
+		return true;
+	}
+
+	// component events
+	void set_observed(ComponentTypeId id, ComponentEvent event, bool observed)
+	{
+		m_events[id].set_observed(event, observed);
+	}
+	bool observed(ComponentTypeId id) const
+	{
+		return m_events[id].observed();
+	}
+	// starts a new batch, later changes are recorded again even if they hit an entity of the collected batch
+	void begin_event_batch()
+	{
+		m_eventTick = m_changeTick;
+		advance_change_tick();
+	}
+	void collect_events(ComponentTypeId id, ComponentEventBatch& batch)
+	{
+		m_events[id].collect(batch, [this, id](EntityId entity) { return used_components(entity).test(id); });
+	}
+
+	// entities whose component addresses changed since the last clear
+	const std::vector<EntityId>& relocated_entities() const
+	{
+		return m_relocated;
+	}
+	void clear_relocated_entities()
+	{
+		m_relocated.clear();
+	}
+	void gui_show_component(EntityId entity, ComponentTypeId id)
+	{
+		if (m_storageMode == ComponentStorageMode::Archetypes)
+			m_archetypeStorage.gui_show_component(entity, id);
+		else
+			m_components[id]->gui_show_component(entity);
 	}
 private:
-	std::unordered_map<const char*, ComponentTypeId> m_typeToId;
-	std::string m_lastTypeToIdStr;
-	ComponentTypeId m_lastTypeToIdId;
-	ComponentTypeId m_newComponentId;
 	std::vector<IComponentList*> m_components; // indexed by ComponentTypeId
-	std::unordered_map<EntityId, std::bitset<ECS_MAX_COMPONENTS>> m_entityComponents;
+	std::vector<std::bitset<ECS_MAX_COMPONENTS>> m_entityComponents; // indexed by EntityId, ids are reused so it stays dense
+
+	ComponentStorageMode m_storageMode;
+	ArchetypeStorage m_archetypeStorage;
+	std::vector<EntityId> m_relocated;
+
+	uint32_t m_changeTick;
+	std::vector<std::vector<uint32_t>> m_changeTicks; // [ComponentTypeId][EntityId], tick of the last change, accessed through atomic_ref during updates
+
+	uint32_t m_eventTick; // change tick of the last event delivery
+	std::unique_ptr<ComponentEventQueue[]> m_events; // indexed by ComponentTypeId
+	std::bitset<ECS_MAX_COMPONENTS>& entity_components(EntityId entity)
+	{
+		if (m_entityComponents.size() <= entity)
+			m_entityComponents.resize(static_cast<size_t>(entity) + 1);
+		return m_entityComponents[entity];
+	}
+	// a new component counts as changed, observers only get the add event
+	void added(ComponentTypeId id, EntityId entity)
+	{
+		auto& ticks = m_changeTicks[id];
+		if (ticks.size() <= entity)
+			ticks.resize(static_cast<size_t>(entity) + 1, 0);
+		ticks[entity] = m_changeTick;
+		if (m_events[id].records_membership())
+			m_events[id].record(ComponentEvent::Added, entity);
+	}
 
 	template<typename T> ComponentList<T>* list(ComponentTypeId id)
 	{
-		return dynamic_cast<ComponentList<T>*>(m_components[id]);
+		return static_cast<ComponentList<T>*>(m_components[id]);
 	}
 
 	friend class GUIManager;
 };
 
+template<typename T> void ensure_prefab_component(ComponentManager& manager)
+{
+	manager.ensure_component<T>();
+}
+
+#include "ecs/query.h"
+
 template<typename... Types>
 struct typelist {};
 
+// access wrappers for the System<Types...> list, plain types count as written
+template<typename T> struct Read {};
+template<typename T> struct Write {};
+
+template<typename T> struct component_access { typedef T type; static constexpr bool declared = false; static constexpr bool write = true; };
+template<typename T> struct component_access<Read<T>> { typedef T type; static constexpr bool declared = true; static constexpr bool write = false; };
+template<typename T> struct component_access<Write<T>> { typedef T type; static constexpr bool declared = true; static constexpr bool write = true; };
+
+template<typename T> using component_t = typename component_access<T>::type;
+
+// shared state outside of the components which systems may declare access to
+#define ECS_RESOURCE_RENDERER (1u << 0) // renderer state, buffer uploads and gizmo draws
+
+struct SystemAccess
+{
+	std::bitset<ECS_MAX_COMPONENTS> reads;
+	std::bitset<ECS_MAX_COMPONENTS> writes;
+	uint32_t resources;
+	bool exclusive; // conflicts with every other system
+};
+
 template<typename Head, typename... Tail>
 std::vector<const char*> get_type_names(typelist<Head, Tail...>& t)
 {
 	std::vector<const char*> types;
-	types.push_back(typeid(Head).name());
+	types.push_back(typeid(component_t<Head>).name());
 	typelist<Tail...> remaining;
 	auto rest = get_type_names(remaining);
 	types.insert(types.end(), rest.begin(), rest.end());
@@ -233,7 +604,7 @@ template<typename Head>
 std::vector<const char*> get_type_names(typelist<Head>& t)
 {
 	std::vector<const char*> types;
-	types.push_back(typeid(Head).name());
+	types.push_back(typeid(component_t<Head>).name());
 	return types;
 }
 
@@ -242,10 +613,31 @@ class ISystem
 public:
 	virtual void start() {}
 	virtual void awake(EntityId entity) {}
+	// all entities which joined the system since the last update
+	virtual void awake(std::span<const EntityId> entities)
+	{
+		for (EntityId entity : entities)
+			awake(entity);
+	}
 	virtual void update(float dt) {}
-	virtual void update(float dt, EntityId entity) {}
+	// systems without per entity work keep the default, it turns the per entity updates off
+	virtual void update(float dt, EntityId entity)
+	{
+		m_updatesEntities = false;
+	}
+	// all entities of the system at once, override either this or the per entity update
+	virtual void update(float dt, std::span<const EntityId> entities)
+	{
+		for (EntityId entity : entities)
+		{
+			update(dt, entity);
+			if (!m_updatesEntities)
+				return;
+		}
+	}
 	virtual void remove(EntityId entity) {}
 	virtual std::vector<const char*> component_types() = 0;
+	virtual std::vector<ComponentTypeId> component_type_ids() = 0;
 	virtual void gui_show_system()
 	{
 		ImGui::Text("no data");
@@ -254,11 +646,39 @@ public:
 	{
 		return typeid(*this).name();
 	}
-	std::vector<EntityId> m_entities; // sorted list of entities
+	const SystemAccess& access() const
+	{
+		return m_access;
+	}
+	SparseSet m_entities; // entities owning all components of the system, unordered
 
 	ECSManager* m_ecs;
+
+	bool m_updatesEntities = true; // cleared once the default per entity update got called
+	void (*m_updateEntities)(ISystem* system, float dt) = nullptr; // set by ECSManager::register_system
+
+protected:
+	// systems without declared access run exclusively, so they never overlap with others
+	SystemAccess m_access = { {}, {}, 0, true };
+
+	// access to components outside of the system signature
+	template<typename T> void declare_read()
+	{
+		m_access.reads.set(component_type_id<T>(), true);
+	}
+	template<typename T> void declare_write()
+	{
+		m_access.writes.set(component_type_id<T>(), true);
+	}
+	void declare_resource(uint32_t resource)
+	{
+		m_access.resources |= resource;
+	}
 };
 
+#include "ecs/scheduler.h"
+#include "ecs/command_buffer.h"
+
 template<typename... Types>
 class System : public ISystem
 {
@@ -267,22 +687,34 @@ public:
 	{
 		typelist<Types...> t;
 		m_types = get_type_names(t);
+		m_typeIds = { component_type_id<component_t<Types>>()... };
+
+		m_access.exclusive = !(component_access<Types>::declared || ...);
+		(m_access.reads.set(component_type_id<component_t<Types>>(), true), ...);
+		(m_access.writes.set(component_type_id<component_t<Types>>(), component_access<Types>::write), ...);
 	}
 	std::vector<const char*> component_types() override
 	{
 		return m_types;
 	}
+	std::vector<ComponentTypeId> component_type_ids() override
+	{
+		return m_typeIds;
+	}
 private:
 	std::vector<const char*> m_types;
+	std::vector<ComponentTypeId> m_typeIds;
 };
 
 class ECSManager
 {
 public:
 	ECSManager(Renderer* renderer) :
-		m_maxEntities(0), m_locked{ false }, m_renderer{ renderer }
+		m_entityCount{ 0 }, m_locked{ false }, m_renderer{ renderer }, m_scheduleDirty{ true }, m_nextObserver{ 0 }, m_dispatchingEvents{ false },
+		m_instance{ next_instance() }
 	{
-		fill_available_entities();
+		m_generations.reserve(ECS_START_ENTITIES);
+		m_freeEntities.reserve(ECS_START_ENTITIES);
 	}
 
 	template<typename S> void register_system(S* system)
@@ -290,77 +722,267 @@ public:
 		m_systems.emplace_back((ISystem*) system);
 		m_systemComponents.push_back(std::bitset<ECS_MAX_COMPONENTS>());
 
-		const auto& systemTypeNames = m_systems.back()->component_types();
-
-		for (auto typeName : systemTypeNames)
-		{
-			m_componentManager.ensure_component(typeName);
-			m_systemComponents.back().set(m_componentManager.type_to_id(typeName), true);
-		}
+		for (auto id : m_systems.back()->component_type_ids())
+			m_systemComponents.back().set(id, true);
 
 		m_systems.back()->m_ecs = this;
+		m_systems.back()->m_updateEntities = &update_entities<S>;
 		m_systems.back()->start();
+
+		m_scheduleDirty = true;
 	}
 	EntityId create_entity()
 	{
-		if (m_availableEntities.size() == 0)
-			fill_available_entities();
+		EntityId entity = reserve_entity();
+		activate_entity(entity);
+		return entity;
+	}
 
-		EntityId entity = m_availableEntities.front();
-		m_availableEntities.pop();
-		m_entities.push_back(entity);
+	// creates count entities owning all Cs and calls init(EntityId, Cs&...) or init(Cs&...) for each of them
+	// the ids are reserved in one go and every system and query registers the whole batch at once
+	template<typename... Cs, typename F> std::vector<EntityId> create_entities(size_t count, F&& init)
+	{
+		std::vector<EntityId> entities = reserve_entities(count);
 
-		m_newEntities.push_back(entity);
+		m_entities.reserve(m_entities.size() + count);
+		m_componentManager.reserve_components<Cs...>(count);
+		for (EntityId entity : entities)
+		{
+			activate_entity(entity);
+			m_componentManager.add_components<Cs...>(entity);
+			if constexpr (std::is_invocable_v<F, EntityId, Cs&...>)
+				init(entity, m_componentManager.get_component<Cs>(entity)...);
+			else
+				init(m_componentManager.get_component<Cs>(entity)...);
+		}
 
-		return entity;
+		// all entities of the batch own exactly Cs
+		std::bitset<ECS_MAX_COMPONENTS> components;
+		(components.set(component_type_id<Cs>(), true), ...);
+		insert_batch(entities, components);
+
+		return entities;
+	}
+	template<typename... Cs> std::vector<EntityId> create_entities(size_t count)
+	{
+		return create_entities<Cs...>(count, [](Cs&...) {});
 	}
+
+	// prefab registry, registered prefabs are frozen and live as long as the manager
+	PrefabId register_prefab(Prefab prefab)
+	{
+		m_prefabs.push_back(std::make_unique<const Prefab>(std::move(prefab)));
+		return static_cast<PrefabId>(m_prefabs.size() - 1);
+	}
+	const Prefab& prefab(PrefabId prefab) const
+	{
+		assert(prefab < m_prefabs.size());
+		return *m_prefabs[prefab];
+	}
+	// creates count entities with copies of all prefab components, like create_entities the batch is registered at once
+	std::vector<EntityId> instantiate(PrefabId prefab, size_t count)
+	{
+		const Prefab& source = this->prefab(prefab);
+		std::vector<EntityId> entities = reserve_entities(count);
+
+		m_entities.reserve(m_entities.size() + count);
+		for (EntityId entity : entities)
+			activate_entity(entity);
+		m_componentManager.add_prefab(entities, source);
+		insert_batch(entities, source.signature());
+
+		return entities;
+	}
+	EntityId instantiate(PrefabId prefab)
+	{
+		return instantiate(prefab, 1).front();
+	}
+
+	EntityHandle handle(EntityId entity) const
+	{
+		return { entity, entity < m_generations.size() ? m_generations[entity] : 0 };
+	}
+	// the handle refers to a live entity, deferred creations become valid once applied
+	bool valid(EntityHandle handle) const
+	{
+		return handle.id < m_generations.size() && m_generations[handle.id] == handle.generation && m_entities.contains(handle.id);
+	}
+	// deleting an entity which is already gone does nothing, its id is only freed once
 	void delete_entity(EntityId entity)
 	{
+		if (!m_entities.contains(entity))
+			return;
+
 		for (auto system : m_systems)
-			if (std::find(system->m_entities.cbegin(), system->m_entities.cend(), entity) != system->m_entities.cend())
+		{
+			if (system->m_entities.contains(entity))
+			{
 				system->remove(entity);
+				system->m_entities.erase(entity);
+			}
+		}
 
-		m_availableEntities.push(entity);
-		std::erase(m_entities, entity);
+		m_entities.erase(entity);
+		free_entity(entity);
 
-		for (size_t i = 0; i < m_systems.size(); i++)
-		{
-			std::erase(m_systems[i]->m_entities, entity);
-		}
+		for (auto query : m_queryList)
+			if (query->contains(entity))
+				query->erase(entity);
 
 		m_componentManager.remove_entity(entity);
+		refresh_queries();
 		std::erase(m_newEntities, entity);
 	}
+	// deletes all entities at once, the new entities are filtered in a single pass
+	void delete_entities(std::vector<EntityId> entities)
+	{
+		std::sort(entities.begin(), entities.end());
+		entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+		delete_sorted_entities(entities);
+	}
+
+	// command buffer of the calling thread
+	// structural changes recorded there are safe during system updates and get applied at the end of update_systems
+	CommandBuffer& commands()
+	{
+		thread_local std::vector<std::pair<uint64_t, CommandBuffer*>> t_buffers; // per ECSManager instance
+		for (auto& [instance, buffer] : t_buffers)
+			if (instance == m_instance)
+				return *buffer;
+
+		std::lock_guard<std::mutex> lock(m_commandMutex);
+		m_commandBuffers.emplace_back(std::make_unique<CommandBuffer>(this));
+		t_buffers.emplace_back(m_instance, m_commandBuffers.back().get());
+		return *m_commandBuffers.back();
+	}
+	// applies the commands of all threads grouped by entity, in recording order per thread
+	// has to be called while no system is updated
+	void apply_commands()
+	{
+		m_pendingCommands.clear();
+		for (auto& buffer : m_commandBuffers)
+			m_pendingCommands.insert(m_pendingCommands.end(), buffer->commands().begin(), buffer->commands().end());
+		if (m_pendingCommands.empty())
+			return;
+
+		std::stable_sort(m_pendingCommands.begin(), m_pendingCommands.end(),
+			[](const EntityCommand& a, const EntityCommand& b) { return a.entity < b.entity; });
+
+		ArenaVector<EntityId> deletedEntities(&m_frameArena);
+		for (auto& command : m_pendingCommands)
+		{
+			// commands are sorted by entity, so a deletion of the current entity is always the last one recorded
+			if (!deletedEntities.empty() && deletedEntities.back() == command.entity)
+			{
+				if (command.payload && command.discard)
+					command.discard(command.payload);
+				continue;
+			}
+
+			switch (command.type)
+			{
+			case EntityCommandType::Create:
+				activate_entity(command.entity);
+				break;
+			case EntityCommandType::Delete:
+				deletedEntities.push_back(command.entity);
+				break;
+			case EntityCommandType::AddComponent:
+			case EntityCommandType::RemoveComponent:
+				command.apply(*this, command.entity, command.payload);
+				break;
+			}
+		}
+		for (auto& buffer : m_commandBuffers)
+			buffer->clear();
+
+		// sorted and unique, since the commands are sorted by entity and repeated deletions are skipped
+		delete_sorted_entities(deletedEntities);
+	}
 
 	template<typename T> T& add_component(EntityId entity)
 	{
 		m_componentManager.add_component<T>(entity);
 
-		const char* typeName = typeid(T).name();
-
-		ComponentTypeId id = m_componentManager.type_to_id(typeName);
+		// only systems and queries using T can start matching
+		ComponentTypeId id = component_type_id<T>();
 		auto entityComponents = used_components(entity);
 
 		for (SystemId systemId = 0; systemId < m_systems.size(); systemId++)
-			if (((entityComponents & m_systemComponents[systemId]) == m_systemComponents[systemId]) && std::find(m_systems[systemId]->m_entities.begin(), m_systems[systemId]->m_entities.end(), entity) == m_systems[systemId]->m_entities.end())
-				m_systems[systemId]->m_entities.push_back(entity);
+			if (m_systemComponents[systemId].test(id) && (entityComponents & m_systemComponents[systemId]) == m_systemComponents[systemId])
+				m_systems[systemId]->m_entities.insert(entity);
+
+		for (auto query : m_queryList)
+			if (query->uses(id) && query->matches(entityComponents))
+				query->insert(entity);
+		refresh_queries();
 
 		return m_componentManager.get_component<T>(entity);
 	}
+	// adds a default constructed T to every entity, memberships are updated once for the whole batch
+	template<typename T> void add_component(std::span<const EntityId> entities)
+	{
+		for (EntityId entity : entities)
+			m_componentManager.add_component<T>(entity);
+
+		ComponentTypeId id = component_type_id<T>();
+		for (SystemId systemId = 0; systemId < m_systems.size(); systemId++)
+		{
+			if (!m_systemComponents[systemId].test(id))
+				continue;
+			auto& systemEntities = m_systems[systemId]->m_entities;
+			systemEntities.reserve(systemEntities.size() + entities.size());
+			for (EntityId entity : entities)
+				if ((used_components(entity) & m_systemComponents[systemId]) == m_systemComponents[systemId])
+					systemEntities.insert(entity);
+		}
+
+		for (auto query : m_queryList)
+			if (query->uses(id))
+				for (EntityId entity : entities)
+					if (query->matches(used_components(entity)))
+						query->insert(entity);
+		refresh_queries();
+	}
 	template<typename T> void remove_component(EntityId entity)
 	{
-		ComponentTypeId id = m_componentManager.type_to_id(typeid(T).name());
-		auto entityComponents = used_components(entity);
+		ComponentTypeId id = component_type_id<T>();
 		for (SystemId systemId = 0; systemId < m_systems.size(); systemId++)
-			if ((entityComponents & m_systemComponents[systemId]) == m_systemComponents[systemId])
-				std::erase(m_systems[systemId]->m_entities, entity);
+			if (m_systemComponents[systemId].test(id) && m_systems[systemId]->m_entities.contains(entity))
+				m_systems[systemId]->m_entities.erase(entity);
+
+		for (auto query : m_queryList)
+			if (query->uses(component_type_id<T>()) && query->contains(entity))
+				query->erase(entity);
 
 		m_componentManager.remove_component<T>(entity);
+		refresh_queries();
 	}
+	// mutable access, marks the component as changed
 	template<typename T> T& get_component(EntityId entity)
+	{
+		m_componentManager.mark_changed<T>(entity);
+		return m_componentManager.get_component<T>(entity);
+	}
+	// read only access which doesn't count as a change
+	template<typename T> const T& read_component(EntityId entity)
 	{
 		return m_componentManager.get_component<T>(entity);
 	}
+	template<typename T> void mark_changed(EntityId entity)
+	{
+		m_componentManager.mark_changed<T>(entity);
+	}
+	template<typename T> bool changed_since(EntityId entity, uint32_t tick) const
+	{
+		return m_componentManager.changed_since<T>(entity, tick);
+	}
+	// advanced before every system update and after the last one
+	// a system which remembers the tick it ran at sees every change made after it in changed_since
+	uint32_t change_tick() const
+	{
+		return m_componentManager.change_tick();
+	}
 	std::bitset<ECS_MAX_COMPONENTS> used_components(EntityId entity)
 	{
 		return m_componentManager.used_components(entity);
@@ -368,7 +990,69 @@ public:
 
 	const std::vector<EntityId>& entities()
 	{
-		return m_entities;
+		return m_entities.dense();
+	}
+
+	// cached query over all entities owning every component in Ts
+	// the entity set and component addresses are maintained on structural changes
+	template<typename... Ts> Query<Ts...>& view()
+	{
+		std::lock_guard<std::mutex> lock(m_queryMutex); // systems may be updated concurrently
+		auto& query = m_queries[std::type_index(typeid(Query<Ts...>))];
+		if (!query)
+		{
+			(m_componentManager.ensure_component<std::remove_const_t<Ts>>(), ...);
+			auto newQuery = new Query<Ts...>(&m_componentManager);
+			for (EntityId entity : m_entities)
+				if (newQuery->matches(used_components(entity)))
+					newQuery->insert(entity);
+			query.reset(newQuery);
+			m_queryList.push_back(newQuery);
+		}
+		return *static_cast<Query<Ts...>*>(query.get());
+	}
+	// calls fn(Ts&...) or fn(EntityId, Ts&...) for every entity owning all Ts
+	// non const Ts are marked as changed, use const Ts for read only iteration
+	template<typename... Ts, typename F> void each(F&& fn)
+	{
+		view<Ts...>().each(fn);
+	}
+
+	// has to be called before the first component is added
+	void set_storage_mode(ComponentStorageMode mode)
+	{
+		m_componentManager.set_storage_mode(mode);
+	}
+	ComponentStorageMode storage_mode() const
+	{
+		return m_componentManager.storage_mode();
+	}
+	// calls fn(count, entities, Ts*... components) over contiguous component arrays
+	// with archetype storage each call covers one chunk, with component lists one entity
+	// all visited components are marked as changed
+	template<typename... Ts, typename F> void for_each_chunk(F&& fn)
+	{
+		if (storage_mode() == ComponentStorageMode::Archetypes)
+		{
+			m_componentManager.for_each_chunk<Ts...>([&](size_t count, EntityId* entities, Ts*... components)
+			{
+				fn(count, entities, components...);
+				for (size_t i = 0; i < count; i++)
+					(m_componentManager.mark_changed<Ts>(entities[i]), ...);
+			});
+			return;
+		}
+
+		(m_componentManager.ensure_component<Ts>(), ...);
+		std::bitset<ECS_MAX_COMPONENTS> required;
+		(required.set(component_type_id<Ts>(), true), ...);
+		for (EntityId entity : m_entities)
+		{
+			if ((used_components(entity) & required) != required)
+				continue;
+			fn(static_cast<size_t>(1), &entity, &m_componentManager.get_component<Ts>(entity)...);
+			(m_componentManager.mark_changed<Ts>(entity), ...);
+		}
 	}
 
 	void update_systems(float dt)
@@ -377,6 +1061,7 @@ public:
 			return;
 
 		ECS_Profiler.begin_label("ecs_update");
+		m_frameArena.reset();
 		PROFILE_START("new entities");
 		if (m_newEntities.size() > 0)
 		{
@@ -385,20 +1070,275 @@ public:
 		}
 		PROFILE_END("new entities");
 
-		for (auto system : m_systems)
+		PROFILE_START("component events");
+		dispatch_component_events();
+		PROFILE_END("component events");
+
+		if (m_threadPool)
 		{
-			ECS_Profiler.out_buf() << system->type_name() << ":\n";
-			PROFILE_START("update whole system");
-			system->update(dt);
-			PROFILE_END("update whole system");
-			PROFILE_START("update single system entities");
-			for (EntityId entity : system->m_entities)
-				system->update(dt, entity);
-			PROFILE_END("update single system entities");
+			update_systems_parallel(dt);
+		}
+		else
+		{
+			for (auto system : m_systems)
+			{
+				m_componentManager.advance_change_tick();
+				ECS_Profiler.out_buf() << system->type_name() << ":\n";
+				PROFILE_START("update whole system");
+				system->update(dt);
+				PROFILE_END("update whole system");
+				PROFILE_START("update single system entities");
+				system->m_updateEntities(system, dt);
+				PROFILE_END("update single system entities");
+			}
 		}
+
+		// changes after the last system update are newer than anything a system saw
+		m_componentManager.advance_change_tick();
+
+		PROFILE_START("apply commands");
+		apply_commands();
+		PROFILE_END("apply commands");
 		ECS_Profiler.end_label();
 	}
 
+	// calls fn(std::span<const EntityId>) at the start of every update_systems, after the new entities got awoken,
+	// with the sorted entities whose T got added, removed or changed since the previous call
+	// per component type removals are delivered before additions and additions before changes,
+	// removed components are already destroyed, so only their ids are left
+	// observers can't be registered or removed from within a callback
+	template<typename T, typename F> ObserverId observe(ComponentEvent event, F&& fn)
+	{
+		assert(!m_dispatchingEvents);
+		m_componentManager.ensure_component<T>();
+		ComponentTypeId id = component_type_id<T>();
+		m_observers.push_back({ m_nextObserver, id, event, std::forward<F>(fn) });
+		m_componentManager.set_observed(id, event, true);
+		return m_nextObserver++;
+	}
+	template<typename T, typename F> ObserverId on_add(F&& fn)
+	{
+		return observe<T>(ComponentEvent::Added, std::forward<F>(fn));
+	}
+	template<typename T, typename F> ObserverId on_remove(F&& fn)
+	{
+		return observe<T>(ComponentEvent::Removed, std::forward<F>(fn));
+	}
+	// a change is any mutable access, see get_component and mark_changed
+	template<typename T, typename F> ObserverId on_change(F&& fn)
+	{
+		return observe<T>(ComponentEvent::Changed, std::forward<F>(fn));
+	}
+	void unobserve(ObserverId observer)
+	{
+		assert(!m_dispatchingEvents);
+		auto it = std::find_if(m_observers.begin(), m_observers.end(), [observer](const ComponentObserver& o) { return o.id == observer; });
+		if (it == m_observers.end())
+			return;
+		ComponentTypeId id = it->type;
+		ComponentEvent event = it->event;
+		m_observers.erase(it);
+		if (std::none_of(m_observers.begin(), m_observers.end(), [&](const ComponentObserver& o) { return o.type == id && o.event == event; }))
+			m_componentManager.set_observed(id, event, false);
+	}
+
+	// with more than one thread, systems with non conflicting declared access are updated concurrently
+	void set_system_threads(int threads)
+	{
+		if (threads <= 1)
+		{
+			m_threadPool.reset();
+			return;
+		}
+		m_threadPool = std::make_unique<ThreadPool>();
+		m_threadPool->initialize(threads);
+	}
+	void dump_schedule(std::ostream& os)
+	{
+		if (m_scheduleDirty)
+			rebuild_schedule();
+		m_scheduler.dump(os);
+	}
+
+	// linear allocator for temporaries of the current frame, it is reset at the start of update_systems
+	FrameArena& frame_arena()
+	{
+		return m_frameArena;
+	}
+	template<typename T> ComponentAllocationStats component_allocation_stats()
+	{
+		return m_componentManager.allocation_stats(component_type_id<T>());
+	}
+	void dump_allocation_stats(std::ostream& os)
+	{
+		const auto& names = component_type_names();
+		for (ComponentTypeId id = 0; id < names.size(); id++)
+		{
+			auto stats = m_componentManager.allocation_stats(id);
+			os << names[id] << ": " << stats.used << " / " << stats.reserved << " bytes\n";
+		}
+		os << "frame arena: " << m_frameArena.used_bytes() << " / " << m_frameArena.reserved_bytes()
+			<< " bytes, peak " << m_frameArena.peak_bytes() << "\n";
+	}
+
+	// writes all entities with their trivially copyable components, other components are left out
+	// pending commands aren't part of it, so take snapshots outside of update_systems
+	// only the ComponentLists storage mode is supported, false without writing anything in archetype mode
+	bool save_snapshot(const std::string& path)
+	{
+		if (storage_mode() != ComponentStorageMode::ComponentLists)
+			return false;
+
+		EcsSnapshotWriter writer(path);
+		if (!writer.good())
+			return false;
+
+		EcsSnapshotHeader header = {};
+		std::memcpy(header.magic, ECS_SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = ECS_SNAPSHOT_VERSION;
+		header.rangeSize = SPACE_CONSISTENT_VECTOR_RANGE_SIZE;
+		header.entitySlots = m_generations.size();
+		header.entityCount = m_entities.size();
+		header.freeCount = m_freeEntities.size();
+		writer.write(&header, sizeof(header));
+
+		header.generationsOffset = writer.offset();
+		writer.write(m_generations.data(), m_generations.size() * sizeof(EntityGeneration));
+		header.entitiesOffset = writer.offset();
+		writer.write(m_entities.dense().data(), m_entities.size() * sizeof(EntityId));
+		header.freeOffset = writer.offset();
+		writer.write(m_freeEntities.data(), m_freeEntities.size() * sizeof(EntityId));
+
+		std::vector<EcsSnapshotComponent> sections;
+		m_componentManager.write_snapshot(writer, sections);
+		writer.align(alignof(EcsSnapshotComponent));
+		header.componentCount = static_cast<uint32_t>(sections.size());
+		header.componentsOffset = writer.offset();
+		writer.write(sections.data(), sections.size() * sizeof(EcsSnapshotComponent));
+
+		writer.patch(0, &header, sizeof(header));
+		return writer.good();
+	}
+	// restores a snapshot into a manager without entities in ComponentLists mode, false otherwise
+	// the components Cs are read and all others in the file skipped
+	// the components are adopted from a copy on write mapping of the file instead of being added one by one
+	// the restored entities are awoken by the next update_systems like newly created ones
+	template<typename... Cs> bool load_snapshot(const std::string& path)
+	{
+		static_assert((std::is_trivially_copyable_v<Cs> && ...), "only trivially copyable components are part of snapshots");
+		if (m_entities.size() != 0 || storage_mode() != ComponentStorageMode::ComponentLists)
+			return false;
+
+		auto file = MappedFile::open(path);
+		if (!file || file->size() < sizeof(EcsSnapshotHeader))
+			return false;
+		EcsSnapshotHeader header;
+		std::memcpy(&header, file->data(), sizeof(header));
+		// the counts are bounded by the file size first, so the table sizes can't overflow
+		if (std::memcmp(header.magic, ECS_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != ECS_SNAPSHOT_VERSION ||
+			header.rangeSize != SPACE_CONSISTENT_VECTOR_RANGE_SIZE ||
+			header.entitySlots > file->size() || header.entityCount > file->size() || header.freeCount > file->size() ||
+			!file->contains(header.generationsOffset, header.entitySlots * sizeof(EntityGeneration)) ||
+			!file->contains(header.entitiesOffset, header.entityCount * sizeof(EntityId)) ||
+			!file->contains(header.freeOffset, header.freeCount * sizeof(EntityId)) ||
+			!file->contains(header.componentsOffset, header.componentCount * sizeof(EcsSnapshotComponent)))
+			return false;
+
+		// every id is checked before any storage is touched, a slot of the snapshot which is either live or free exactly once
+		std::vector<EntityId> entities(header.entityCount);
+		std::memcpy(entities.data(), file->data() + header.entitiesOffset, header.entityCount * sizeof(EntityId));
+		std::vector<EntityId> freeEntities(header.freeCount);
+		std::memcpy(freeEntities.data(), file->data() + header.freeOffset, header.freeCount * sizeof(EntityId));
+		enum SlotState : uint8_t { Unused, Live, Free };
+		std::vector<uint8_t> slots(header.entitySlots, Unused);
+		for (EntityId entity : entities)
+		{
+			if (entity >= header.entitySlots || slots[entity] != Unused)
+				return false;
+			slots[entity] = Live;
+		}
+		for (EntityId entity : freeEntities)
+		{
+			if (entity >= header.entitySlots || slots[entity] != Unused)
+				return false;
+			slots[entity] = Free;
+		}
+
+		// the sections of Cs, each component only once and owned by live entities without duplicates
+		std::array<ComponentTypeId, sizeof...(Cs)> ids = { component_type_id<Cs>()... };
+		std::array<size_t, sizeof...(Cs)> sizes = { sizeof(Cs)... };
+		std::array<size_t, sizeof...(Cs)> alignments = { alignof(Cs)... };
+		const auto& names = component_type_names();
+		std::vector<std::pair<ComponentTypeId, EcsSnapshotComponent>> sections;
+		std::vector<uint32_t> owners(header.entitySlots, UINT32_MAX); // last section per entity
+		for (uint32_t i = 0; i < header.componentCount; i++)
+		{
+			EcsSnapshotComponent section;
+			std::memcpy(&section, file->data() + header.componentsOffset + i * sizeof(EcsSnapshotComponent), sizeof(section));
+			if (!file->contains(section.nameOffset, section.nameLength))
+				return false;
+			std::string_view name(reinterpret_cast<const char*>(file->data() + section.nameOffset), section.nameLength);
+			auto id = std::find_if(ids.begin(), ids.end(), [&](ComponentTypeId id) { return name == names[id]; });
+			if (id == ids.end())
+				continue;
+
+			// the element layout has to match the type, the ranges have to lie in the file
+			size_t type = id - ids.begin();
+			uint64_t ranges = (section.count + SPACE_CONSISTENT_VECTOR_RANGE_SIZE - 1) / SPACE_CONSISTENT_VECTOR_RANGE_SIZE;
+			bool repeated = std::any_of(sections.begin(), sections.end(), [&](const auto& other) { return other.first == *id; });
+			if (repeated || section.count > file->size() || section.entitiesOffset % alignof(EntityId) != 0 ||
+				!file->contains(section.entitiesOffset, section.count * sizeof(EntityId)) ||
+				section.elementSize != sizes[type] || section.dataOffset % alignments[type] != 0 ||
+				section.rangeStride < SPACE_CONSISTENT_VECTOR_RANGE_SIZE * sizes[type] ||
+				(ranges > 0 && section.rangeStride > file->size() / ranges) ||
+				!file->contains(section.dataOffset, ranges * section.rangeStride))
+				return false;
+			for (size_t j = 0; j < section.count; j++)
+			{
+				EntityId entity;
+				std::memcpy(&entity, file->data() + section.entitiesOffset + j * sizeof(EntityId), sizeof(entity));
+				if (entity >= header.entitySlots || slots[entity] != Live || owners[entity] == i)
+					return false;
+				owners[entity] = i;
+			}
+			sections.emplace_back(*id, section);
+		}
+
+		// entity ids, generations and the free list continue where the snapshot left off
+		{
+			std::lock_guard<std::mutex> lock(m_entityMutex);
+			m_generations.resize(header.entitySlots);
+			std::memcpy(m_generations.data(), file->data() + header.generationsOffset, header.entitySlots * sizeof(EntityGeneration));
+			m_freeEntities = std::move(freeEntities);
+			m_entityCount = static_cast<EntityId>(header.entitySlots);
+		}
+		m_entities.reserve(entities.size());
+		for (EntityId entity : entities)
+			m_entities.insert(entity);
+		m_newEntities.insert(m_newEntities.end(), entities.begin(), entities.end());
+
+		// every section was checked above and Cs are trivially copyable, so restoring them can't fail
+		(m_componentManager.ensure_component<Cs>(), ...);
+		for (const auto& [id, section] : sections)
+			m_componentManager.restore_snapshot(id, file, section);
+
+		// every system and query matching the restored component sets
+		for (SystemId systemId = 0; systemId < m_systems.size(); systemId++)
+		{
+			auto& systemEntities = m_systems[systemId]->m_entities;
+			for (EntityId entity : entities)
+				if ((used_components(entity) & m_systemComponents[systemId]) == m_systemComponents[systemId])
+					systemEntities.insert(entity);
+		}
+		for (auto query : m_queryList)
+			for (EntityId entity : entities)
+				if (query->matches(used_components(entity)))
+					query->insert(entity);
+		refresh_queries();
+
+		return true;
+	}
+
 	void lock()
 	{
 		m_locked = true;
@@ -414,39 +1354,237 @@ private:
 	std::vector<std::bitset<ECS_MAX_COMPONENTS>> m_systemComponents; // bitset for all systems for used components
 	// std::unordered_map<const char*, ComponentTypeId> m_componentTypeToId;
 
-	std::vector<EntityId> m_entities;
+	SparseSet m_entities;
 	std::vector<EntityId> m_newEntities;
+
+	std::vector<std::unique_ptr<const Prefab>> m_prefabs; // indexed by PrefabId
+	// adds new entities which all own exactly components to the matching systems and queries
+	void insert_batch(std::span<const EntityId> entities, const std::bitset<ECS_MAX_COMPONENTS>& components)
+	{
+		for (SystemId systemId = 0; systemId < m_systems.size(); systemId++)
+		{
+			if ((components & m_systemComponents[systemId]) != m_systemComponents[systemId])
+				continue;
+			auto& systemEntities = m_systems[systemId]->m_entities;
+			systemEntities.reserve(systemEntities.size() + entities.size());
+			for (EntityId entity : entities)
+				systemEntities.insert(entity);
+		}
+		for (auto query : m_queryList)
+			if (query->matches(components))
+				for (EntityId entity : entities)
+					query->insert(entity);
+		refresh_queries();
+	}
+
+	std::unordered_map<std::type_index, std::unique_ptr<IQuery>> m_queries;
+	std::vector<IQuery*> m_queryList;
+	std::mutex m_queryMutex;
+	void refresh_queries()
+	{
+		for (EntityId entity : m_componentManager.relocated_entities())
+			for (auto query : m_queryList)
+				if (query->contains(entity))
+					query->refresh(entity);
+		m_componentManager.clear_relocated_entities();
+	}
 	void awake_entities()
 	{
+		ArenaVector<EntityId> systemEntities(&m_frameArena);
+		systemEntities.reserve(m_newEntities.size());
 		for (auto system : m_systems)
 		{
-			std::vector<EntityId> newEntities;
-			std::sort(m_newEntities.begin(), m_newEntities.end());
-			std::sort(system->m_entities.begin(), system->m_entities.end());
-			std::set_intersection(
-				system->m_entities.begin(),
-				system->m_entities.end(),
-				m_newEntities.begin(),
-				m_newEntities.end(),
-				std::back_inserter(newEntities)
-			);
-			for (EntityId entity : newEntities)
-				system->awake(entity);
+			systemEntities.clear();
+			for (EntityId entity : m_newEntities)
+				if (system->m_entities.contains(entity))
+					systemEntities.push_back(entity);
+			if (!systemEntities.empty())
+				system->awake(std::span<const EntityId>(systemEntities));
 		}
 	}
 
-	std::queue<EntityId> m_availableEntities;
-	size_t m_maxEntities;
-	void fill_available_entities()
+	std::vector<EntityGeneration> m_generations; // per entity slot, grows only when entities are activated
+	std::vector<EntityId> m_freeEntities; // deleted ids, reused last in first out
+	EntityId m_entityCount; // slots handed out so far
+	std::mutex m_entityMutex; // entity ids are reserved from command buffers of concurrently updated systems
+	EntityId reserve_entity()
 	{
-		for (size_t i = m_maxEntities; i < m_maxEntities + ECS_START_ENTITIES; i++)
-			m_availableEntities.push(i);
-		m_maxEntities += ECS_START_ENTITIES;
+		std::lock_guard<std::mutex> lock(m_entityMutex);
+		if (m_freeEntities.empty())
+			return m_entityCount++;
+
+		EntityId entity = m_freeEntities.back();
+		m_freeEntities.pop_back();
+		return entity;
+	}
+	std::vector<EntityId> reserve_entities(size_t count)
+	{
+		std::vector<EntityId> entities(count);
+		std::lock_guard<std::mutex> lock(m_entityMutex);
+		size_t reused = std::min(count, m_freeEntities.size());
+		std::copy(m_freeEntities.end() - reused, m_freeEntities.end(), entities.begin());
+		m_freeEntities.resize(m_freeEntities.size() - reused);
+		for (size_t i = reused; i < count; i++)
+			entities[i] = m_entityCount++;
+		return entities;
+	}
+	void activate_entity(EntityId entity)
+	{
+		if (m_generations.size() <= entity)
+			m_generations.resize(entity + 1, 0);
+		m_entities.insert(entity);
+		m_newEntities.push_back(entity);
+	}
+	// invalidates all handles of the entity before its id gets reused
+	void free_entity(EntityId entity)
+	{
+		assert(entity < m_generations.size());
+		m_generations[entity]++;
+		std::lock_guard<std::mutex> lock(m_entityMutex);
+		m_freeEntities.push_back(entity);
 	}
 
 	ComponentManager m_componentManager;
 
+	SystemScheduler m_scheduler;
+	std::unique_ptr<ThreadPool> m_threadPool;
+	bool m_scheduleDirty;
+	void rebuild_schedule()
+	{
+		m_scheduler.build(m_systems);
+		m_scheduleDirty = false;
+	}
+	static void update_system(ISystem* system, float dt)
+	{
+		system->update(dt);
+		system->m_updateEntities(system, dt);
+	}
+	// per entity updates of a system registered as S
+	// if S is final and has update(float, EntityId), the qualified call binds statically and can be inlined into the loop
+	// otherwise a derived class may override it, so the span update is dispatched virtually once
+	template<typename S> static void update_entities(ISystem* system, float dt)
+	{
+		if (!system->m_updatesEntities || system->m_entities.empty())
+			return;
+
+		if constexpr (std::is_final_v<S> && requires(S* s, float dt, EntityId entity) { s->S::update(dt, entity); })
+		{
+			S* s = (S*) system; // systems may inherit privately from System
+			for (EntityId entity : system->m_entities)
+			{
+				s->S::update(dt, entity);
+				if (!system->m_updatesEntities)
+					return;
+			}
+		}
+		else
+		{
+			system->update(dt, std::span<const EntityId>(system->m_entities.dense()));
+		}
+	}
+	void update_systems_parallel(float dt)
+	{
+		if (m_scheduleDirty)
+			rebuild_schedule();
+
+		for (const auto& level : m_scheduler.levels())
+		{
+			// systems of a level never write what another one of the level reads, so they can share a tick
+			m_componentManager.advance_change_tick();
+			PROFILE_START("update system level");
+			if (level.size() == 1)
+			{
+				update_system(level.front(), dt);
+			}
+			else
+			{
+				for (auto system : level)
+					m_threadPool->doJob([system, dt]() { update_system(system, dt); });
+				m_threadPool->wait_for_finish();
+			}
+			PROFILE_END("update system level");
+		}
+	}
+
+	FrameArena m_frameArena;
+
+	std::vector<ComponentObserver> m_observers; // in registration order
+	ObserverId m_nextObserver;
+	ComponentEventBatch m_eventBatch; // reused, so delivering events doesn't allocate
+	bool m_dispatchingEvents;
+	void dispatch_component_events()
+	{
+		if (m_observers.empty())
+			return;
+
+		m_dispatchingEvents = true;
+		m_componentManager.begin_event_batch();
+		const ComponentEvent order[] = { ComponentEvent::Removed, ComponentEvent::Added, ComponentEvent::Changed };
+		for (ComponentTypeId id = 0; id < component_type_names().size(); id++)
+		{
+			if (!m_componentManager.observed(id))
+				continue;
+
+			m_componentManager.collect_events(id, m_eventBatch);
+			for (ComponentEvent event : order)
+			{
+				std::span<const EntityId> entities(m_eventBatch[event]);
+				if (entities.empty())
+					continue;
+				for (auto& observer : m_observers)
+					if (observer.type == id && observer.event == event)
+						observer.callback(entities);
+			}
+		}
+		m_dispatchingEvents = false;
+	}
+
+	// entities has to be sorted and free of duplicates, entities which are already gone are skipped
+	void delete_sorted_entities(std::span<const EntityId> entities)
+	{
+		if (entities.empty())
+			return;
+
+		for (auto system : m_systems)
+		{
+			for (EntityId entity : entities)
+			{
+				if (system->m_entities.contains(entity))
+				{
+					system->remove(entity);
+					system->m_entities.erase(entity);
+				}
+			}
+		}
+		std::erase_if(m_newEntities, [&entities](EntityId entity) { return std::binary_search(entities.begin(), entities.end(), entity); });
+
+		for (EntityId entity : entities)
+		{
+			if (!m_entities.contains(entity))
+				continue;
+
+			for (auto query : m_queryList)
+				if (query->contains(entity))
+					query->erase(entity);
+			m_componentManager.remove_entity(entity);
+			m_entities.erase(entity);
+			free_entity(entity);
+		}
+		refresh_queries();
+	}
+
+	uint64_t m_instance; // tells the thread local command buffer lookups of different managers apart
+	std::vector<std::unique_ptr<CommandBuffer>> m_commandBuffers; // one per thread which recorded commands
+	std::vector<EntityCommand> m_pendingCommands;
+	std::mutex m_commandMutex;
+	static uint64_t next_instance()
+	{
+		static std::atomic<uint64_t> s_nextInstance{ 1 };
+		return s_nextInstance++;
+	}
+
 	friend class GUIManager;
+	friend class CommandBuffer;
 
 	bool m_locked;
 
@@ -456,6 +1594,23 @@ private:
 	//}
 };
 
+inline EntityId CommandBuffer::create_entity()
+{
+	EntityId entity = m_ecs->reserve_entity();
+	m_commands.push_back({ EntityCommandType::Create, entity, nullptr, nullptr, nullptr });
+	return entity;
+}
+template<typename T> void apply_add_component_command(ECSManager& ecs, EntityId entity, void* payload)
+{
+	T* component = static_cast<T*>(payload);
+	ecs.add_component<T>(entity) = std::move(*component);
+	component->~T();
+}
+template<typename T> void apply_remove_component_command(ECSManager& ecs, EntityId entity, void* payload)
+{
+	ecs.remove_component<T>(entity);
+}
+
 #undef PROFILE_START
 #undef PROFILE_END
 #undef PROFILE_LABEL
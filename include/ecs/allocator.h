@@ -0,0 +1,198 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// allocation backends of the ECS, included from ecs.h before the component storages
+
+#ifndef ECS_POOL_BLOCKS_PER_SLAB
+#define ECS_POOL_BLOCKS_PER_SLAB 16 // blocks a pool requests from the heap at once
+#endif
+#ifndef ECS_FRAME_ARENA_BLOCK_SIZE
+#define ECS_FRAME_ARENA_BLOCK_SIZE (256 * 1024) // bytes per frame arena block
+#endif
+
+struct ComponentAllocationStats
+{
+	size_t reserved; // bytes taken from the heap
+	size_t used; // bytes holding live components
+};
+
+// fixed size block allocator, freed blocks are kept in an intrusive free list and reused
+// the slabs are only returned to the heap when the pool is destroyed
+class ComponentPool
+{
+public:
+	ComponentPool(size_t blockSize, size_t alignment) :
+		m_blockSize{ std::max(blockSize, sizeof(void*)) }, m_alignment{ std::max(alignment, alignof(void*)) },
+		m_free{ nullptr }, m_usedBlocks{ 0 }
+	{
+		m_blockSize = (m_blockSize + m_alignment - 1) / m_alignment * m_alignment;
+	}
+	~ComponentPool()
+	{
+		for (void* slab : m_slabs)
+			::operator delete(slab, std::align_val_t(m_alignment));
+	}
+	ComponentPool(const ComponentPool&) = delete;
+	ComponentPool& operator=(const ComponentPool&) = delete;
+
+	void* allocate()
+	{
+		if (!m_free)
+			new_slab();
+
+		void* block = m_free;
+		m_free = *static_cast<void**>(block);
+		m_usedBlocks++;
+		return block;
+	}
+	void deallocate(void* block)
+	{
+		*static_cast<void**>(block) = m_free;
+		m_free = block;
+		m_usedBlocks--;
+	}
+
+	// counts blocks from outside the slabs as used, they may be passed to deallocate and get reused afterwards
+	// their memory has to outlive the pool
+	void adopt_blocks(size_t count)
+	{
+		m_usedBlocks += count;
+	}
+
+	size_t block_size() const { return m_blockSize; }
+	size_t reserved_bytes() const { return m_slabs.size() * ECS_POOL_BLOCKS_PER_SLAB * m_blockSize; }
+	size_t used_bytes() const { return m_usedBlocks * m_blockSize; }
+
+private:
+	size_t m_blockSize;
+	size_t m_alignment;
+	std::vector<void*> m_slabs;
+	void* m_free; // next free block, every free block starts with the pointer to the following one
+	size_t m_usedBlocks;
+
+	void new_slab()
+	{
+		std::byte* slab = static_cast<std::byte*>(::operator new(m_blockSize * ECS_POOL_BLOCKS_PER_SLAB, std::align_val_t(m_alignment)));
+		m_slabs.push_back(slab);
+		for (size_t i = ECS_POOL_BLOCKS_PER_SLAB; i > 0; i--)
+			deallocate(slab + (i - 1) * m_blockSize);
+		m_usedBlocks += ECS_POOL_BLOCKS_PER_SLAB;
+	}
+};
+
+// range allocator for space_consistent_vector which takes the ranges from a pool
+struct PoolRangeAllocator
+{
+	ComponentPool* pool;
+
+	void* allocate_range(size_t bytes, std::align_val_t alignment)
+	{
+		assert(bytes <= pool->block_size());
+		return pool->allocate();
+	}
+	void deallocate_range(void* range, size_t bytes, std::align_val_t alignment)
+	{
+		pool->deallocate(range);
+	}
+};
+
+// linear allocator for temporaries which live at most until the next reset
+// deallocations are no-ops, the blocks are kept and reused after every reset
+class FrameArena
+{
+public:
+	FrameArena() :
+		m_block{ 0 }, m_offset{ 0 }, m_used{ 0 }, m_peak{ 0 }
+	{}
+	~FrameArena()
+	{
+		for (void* block : m_blocks)
+			::operator delete(block, std::align_val_t(alignof(std::max_align_t)));
+	}
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		assert(alignment <= alignof(std::max_align_t));
+		std::lock_guard<std::mutex> lock(m_mutex); // systems may allocate concurrently
+
+		if (bytes > ECS_FRAME_ARENA_BLOCK_SIZE)
+		{
+			// oversized requests get a dedicated block which is freed on reset
+			m_largeBlocks.push_back(::operator new(bytes, std::align_val_t(alignof(std::max_align_t))));
+			m_used += bytes;
+			return m_largeBlocks.back();
+		}
+
+		m_offset = (m_offset + alignment - 1) & ~(alignment - 1);
+		if (m_block < m_blocks.size() && m_offset + bytes > ECS_FRAME_ARENA_BLOCK_SIZE)
+		{
+			m_block++;
+			m_offset = 0;
+		}
+		if (m_block == m_blocks.size())
+			m_blocks.push_back(::operator new(ECS_FRAME_ARENA_BLOCK_SIZE, std::align_val_t(alignof(std::max_align_t))));
+
+		void* ptr = static_cast<std::byte*>(m_blocks[m_block]) + m_offset;
+		m_offset += bytes;
+		m_used += bytes;
+		return ptr;
+	}
+	// invalidates everything allocated since the last reset
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (void* block : m_largeBlocks)
+			::operator delete(block, std::align_val_t(alignof(std::max_align_t)));
+		m_largeBlocks.clear();
+
+		m_peak = std::max(m_peak, m_used);
+		m_block = 0;
+		m_offset = 0;
+		m_used = 0;
+	}
+
+	size_t reserved_bytes() const { return m_blocks.size() * ECS_FRAME_ARENA_BLOCK_SIZE; }
+	size_t used_bytes() const { return m_used; }
+	size_t peak_bytes() const { return std::max(m_peak, m_used); } // most bytes used within one frame
+
+private:
+	std::vector<void*> m_blocks;
+	std::vector<void*> m_largeBlocks;
+	size_t m_block; // block currently allocated from
+	size_t m_offset; // bytes used in the current block
+	size_t m_used;
+	size_t m_peak;
+	std::mutex m_mutex;
+};
+
+// std allocator on top of a FrameArena, for containers which are dropped before the next reset
+template<typename T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	FrameArena* arena;
+
+	ArenaAllocator(FrameArena* arena) : arena{ arena } {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena{ other.arena } {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+	void deallocate(T* ptr, size_t count) {}
+
+	template<typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+};
+
+template<typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// included from ecs.h, which provides EntityId, ComponentTypeId, ECS_MAX_COMPONENTS and the ComponentPool
+
+#ifndef ECS_ARCHETYPE_CHUNK_SIZE
+#define ECS_ARCHETYPE_CHUNK_SIZE 16384 // bytes per chunk
+#endif
+
+#define ECS_ARCHETYPE_COLUMN_ALIGNMENT 64
+#define ECS_ARCHETYPE_NO_COLUMN -1
+
+enum class ComponentStorageMode
+{
+	ComponentLists, // one list per component type, addresses stay valid until the component itself is removed
+	Archetypes // entities with the same component set share SoA chunks, addresses change on structural changes
+};
+
+// type erased operations on a single component, so chunks can be managed without knowing T
+struct ArchetypeComponentInfo
+{
+	size_t size;
+	size_t alignment;
+	void (*construct)(void* dst);
+	void (*relocate)(void* dst, void* src); // move construct dst from src and destroy src
+	void (*destroy)(void* component);
+	void (*gui_show)(void* component);
+};
+
+template<typename T>
+ArchetypeComponentInfo make_archetype_component_info()
+{
+	ArchetypeComponentInfo info = {};
+	info.size = sizeof(T);
+	info.alignment = alignof(T);
+	info.construct = [](void* dst) { new (dst) T(); };
+	info.relocate = [](void* dst, void* src)
+	{
+		new (dst) T(std::move(*static_cast<T*>(src)));
+		static_cast<T*>(src)->~T();
+	};
+	info.destroy = [](void* component) { static_cast<T*>(component)->~T(); };
+	info.gui_show = [](void* component)
+	{
+		gui_print_component<T> g;
+		g(*static_cast<T*>(component));
+	};
+	return info;
+}
+
+struct ArchetypeChunk
+{
+	std::byte* data;
+	size_t count;
+};
+
+// all entities with exactly one component signature
+// the rows are kept densely packed: only the last chunk may be partially filled
+class Archetype
+{
+public:
+	// chunks which fit into ECS_ARCHETYPE_CHUNK_SIZE come from the shared chunk pool
+	Archetype(std::bitset<ECS_MAX_COMPONENTS> signature, const std::vector<ArchetypeComponentInfo>& infos, ComponentPool* chunkPool) :
+		m_signature{ signature }, m_chunkPool{ chunkPool }, m_count{ 0 }
+	{
+		m_columnIndex.fill(ECS_ARCHETYPE_NO_COLUMN);
+		size_t rowSize = sizeof(EntityId);
+		for (ComponentTypeId id = 0; id < ECS_MAX_COMPONENTS; id++)
+		{
+			if (!signature.test(id))
+				continue;
+			m_columnIndex[id] = static_cast<int>(m_columns.size());
+			m_columns.push_back({ id, 0, infos[id] });
+			rowSize += infos[id].size;
+		}
+
+		// shrink the capacity until the aligned columns fit into one chunk
+		m_capacity = ECS_ARCHETYPE_CHUNK_SIZE / rowSize;
+		while (m_capacity > 1 && layout(m_capacity) > ECS_ARCHETYPE_CHUNK_SIZE)
+			m_capacity--;
+		if (m_capacity == 0)
+			m_capacity = 1;
+		m_chunkBytes = layout(m_capacity);
+	}
+	~Archetype()
+	{
+		for (size_t chunk = 0; chunk < m_chunks.size(); chunk++)
+		{
+			for (size_t row = 0; row < m_chunks[chunk].count; row++)
+				for (const auto& column : m_columns)
+					column.info.destroy(component_at(chunk, row, column));
+			free_chunk(m_chunks[chunk].data);
+		}
+	}
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	const std::bitset<ECS_MAX_COMPONENTS>& signature() const { return m_signature; }
+	bool has(ComponentTypeId id) const { return m_columnIndex[id] != ECS_ARCHETYPE_NO_COLUMN; }
+	size_t size() const { return m_count; }
+	size_t chunk_count() const { return m_chunks.size(); }
+	size_t chunk_capacity() const { return m_capacity; }
+	size_t chunk_size(size_t chunk) const { return m_chunks[chunk].count; }
+	size_t chunk_bytes() const { return m_chunkBytes; }
+	size_t component_size(ComponentTypeId id) const { return m_columns[m_columnIndex[id]].info.size; }
+
+	EntityId* entities(size_t chunk)
+	{
+		return reinterpret_cast<EntityId*>(m_chunks[chunk].data);
+	}
+	// start of the contiguous array of one component type inside a chunk
+	void* column(size_t chunk, ComponentTypeId id)
+	{
+		return m_chunks[chunk].data + m_columns[m_columnIndex[id]].offset;
+	}
+	void* component(size_t chunk, size_t row, ComponentTypeId id)
+	{
+		return component_at(chunk, row, m_columns[m_columnIndex[id]]);
+	}
+
+	// reserves a row for the entity, the components in it are left uninitialized
+	void push_entity(EntityId entity, size_t& chunk, size_t& row)
+	{
+		if (m_chunks.empty() || m_chunks.back().count == m_capacity)
+		{
+			ArchetypeChunk newChunk = {};
+			newChunk.data = allocate_chunk();
+			newChunk.count = 0;
+			m_chunks.push_back(newChunk);
+		}
+		chunk = m_chunks.size() - 1;
+		row = m_chunks.back().count++;
+		entities(chunk)[row] = entity;
+		m_count++;
+	}
+	// closes the hole of an already destroyed or relocated row with the last row
+	// returns true and the moved entity if another entity changed its position
+	bool erase_row(size_t chunk, size_t row, EntityId& movedEntity)
+	{
+		size_t lastChunk = m_chunks.size() - 1;
+		size_t lastRow = m_chunks.back().count - 1;
+
+		bool moved = chunk != lastChunk || row != lastRow;
+		if (moved)
+		{
+			for (const auto& column : m_columns)
+				column.info.relocate(component_at(chunk, row, column), component_at(lastChunk, lastRow, column));
+			movedEntity = entities(lastChunk)[lastRow];
+			entities(chunk)[row] = movedEntity;
+		}
+
+		m_count--;
+		if (--m_chunks.back().count == 0)
+		{
+			free_chunk(m_chunks.back().data);
+			m_chunks.pop_back();
+		}
+		return moved;
+	}
+
+private:
+	struct Column
+	{
+		ComponentTypeId type;
+		size_t offset;
+		ArchetypeComponentInfo info;
+	};
+
+	std::bitset<ECS_MAX_COMPONENTS> m_signature;
+	std::vector<Column> m_columns; // sorted by component type id
+	std::array<int, ECS_MAX_COMPONENTS> m_columnIndex; // component type id -> column
+
+	std::vector<ArchetypeChunk> m_chunks;
+	ComponentPool* m_chunkPool;
+	size_t m_capacity; // rows per chunk
+	size_t m_chunkBytes;
+	size_t m_count;
+
+	// a single row bigger than a chunk gets an oversized chunk from the heap
+	std::byte* allocate_chunk()
+	{
+		if (m_chunkBytes > m_chunkPool->block_size())
+			return static_cast<std::byte*>(::operator new(m_chunkBytes, std::align_val_t(ECS_ARCHETYPE_COLUMN_ALIGNMENT)));
+		return static_cast<std::byte*>(m_chunkPool->allocate());
+	}
+	void free_chunk(std::byte* data)
+	{
+		if (m_chunkBytes > m_chunkPool->block_size())
+			::operator delete(data, std::align_val_t(ECS_ARCHETYPE_COLUMN_ALIGNMENT));
+		else
+			m_chunkPool->deallocate(data);
+	}
+
+	void* component_at(size_t chunk, size_t row, const Column& column)
+	{
+		return m_chunks[chunk].data + column.offset + row * column.info.size;
+	}
+
+	// computes the column offsets for the given row count and returns the needed bytes
+	size_t layout(size_t capacity)
+	{
+		size_t offset = sizeof(EntityId) * capacity;
+		for (auto& column : m_columns)
+		{
+			size_t alignment = std::max(column.info.alignment, static_cast<size_t>(ECS_ARCHETYPE_COLUMN_ALIGNMENT));
+			offset = (offset + alignment - 1) / alignment * alignment;
+			column.offset = offset;
+			offset += column.info.size * capacity;
+		}
+		return offset;
+	}
+};
+
+// storage backend which groups entities by their component signature
+class ArchetypeStorage
+{
+public:
+	template<typename T> void register_component(ComponentTypeId id)
+	{
+		if (m_infos.size() <= id)
+			m_infos.resize(id + 1);
+		m_infos[id] = make_archetype_component_info<T>();
+	}
+
+	// structural changes append every entity whose components moved to relocated
+	void* add_component(EntityId entity, ComponentTypeId id, std::vector<EntityId>& relocated)
+	{
+		std::bitset<ECS_MAX_COMPONENTS> signature;
+		if (contains(entity))
+			signature = m_archetypes[m_locations[entity].archetype]->signature();
+		signature.set(id, true);
+
+		move_entity(entity, signature, relocated);
+
+		const auto& location = m_locations[entity];
+		return m_archetypes[location.archetype]->component(location.chunk, location.row, id);
+	}
+	void add_components(EntityId entity, const std::bitset<ECS_MAX_COMPONENTS>& components, std::vector<EntityId>& relocated)
+	{
+		std::bitset<ECS_MAX_COMPONENTS> signature = components;
+		if (contains(entity))
+			signature |= m_archetypes[m_locations[entity].archetype]->signature();
+
+		move_entity(entity, signature, relocated);
+	}
+	void remove_component(EntityId entity, ComponentTypeId id, std::vector<EntityId>& relocated)
+	{
+		assert(contains(entity));
+
+		auto signature = m_archetypes[m_locations[entity].archetype]->signature();
+		signature.set(id, false);
+
+		move_entity(entity, signature, relocated);
+	}
+	void remove_entity(EntityId entity, std::vector<EntityId>& relocated)
+	{
+		if (contains(entity))
+			move_entity(entity, std::bitset<ECS_MAX_COMPONENTS>(), relocated);
+	}
+	void* get(EntityId entity, ComponentTypeId id)
+	{
+		const auto& location = m_locations[entity];
+		return m_archetypes[location.archetype]->component(location.chunk, location.row, id);
+	}
+	bool contains(EntityId entity) const
+	{
+		return entity < m_locations.size() && m_locations[entity].archetype != InvalidArchetype;
+	}
+	void gui_show_component(EntityId entity, ComponentTypeId id)
+	{
+		m_infos[id].gui_show(get(entity, id));
+	}
+
+	// calls fn(count, entities, Ts* columns...) for every chunk of every archetype containing all Ts
+	template<typename... Ts, typename F>
+	void for_each_chunk(const std::array<ComponentTypeId, sizeof...(Ts)>& ids, F&& fn)
+	{
+		std::bitset<ECS_MAX_COMPONENTS> required;
+		for (auto id : ids)
+			required.set(id, true);
+
+		for (auto& archetype : m_archetypes)
+		{
+			if ((archetype->signature() & required) != required)
+				continue;
+			for (size_t chunk = 0; chunk < archetype->chunk_count(); chunk++)
+				call_chunk<Ts...>(*archetype, chunk, ids, fn, std::index_sequence_for<Ts...>{});
+		}
+	}
+
+	const std::vector<std::unique_ptr<Archetype>>& archetypes() const { return m_archetypes; }
+
+	// reserved counts the column slots of all chunks holding the type, the chunks themselves are shared
+	ComponentAllocationStats allocation_stats(ComponentTypeId id) const
+	{
+		ComponentAllocationStats stats = { 0, 0 };
+		for (const auto& archetype : m_archetypes)
+		{
+			if (!archetype->has(id))
+				continue;
+			stats.reserved += archetype->chunk_count() * archetype->chunk_capacity() * archetype->component_size(id);
+			stats.used += archetype->size() * archetype->component_size(id);
+		}
+		return stats;
+	}
+	// bytes of all chunks taken from the heap
+	size_t chunk_reserved_bytes() const { return m_chunkPool.reserved_bytes(); }
+
+private:
+	static constexpr uint32_t InvalidArchetype = UINT32_MAX;
+
+	struct EntityLocation
+	{
+		uint32_t archetype;
+		uint32_t chunk;
+		uint32_t row;
+	};
+
+	std::vector<EntityLocation> m_locations; // indexed by EntityId
+	ComponentPool m_chunkPool{ ECS_ARCHETYPE_CHUNK_SIZE, ECS_ARCHETYPE_COLUMN_ALIGNMENT }; // declared before the archetypes which return their chunks to it
+	std::vector<std::unique_ptr<Archetype>> m_archetypes;
+	std::unordered_map<std::bitset<ECS_MAX_COMPONENTS>, uint32_t> m_archetypeLookup;
+	std::vector<ArchetypeComponentInfo> m_infos; // indexed by ComponentTypeId
+
+	uint32_t archetype_index(const std::bitset<ECS_MAX_COMPONENTS>& signature)
+	{
+		auto it = m_archetypeLookup.find(signature);
+		if (it != m_archetypeLookup.end())
+			return it->second;
+
+		uint32_t index = static_cast<uint32_t>(m_archetypes.size());
+		m_archetypes.emplace_back(std::make_unique<Archetype>(signature, m_infos, &m_chunkPool));
+		m_archetypeLookup[signature] = index;
+		return index;
+	}
+
+	// moves the entity with all shared components into the archetype of the new signature
+	// components only present in the new signature are default constructed, dropped ones destroyed
+	void move_entity(EntityId entity, const std::bitset<ECS_MAX_COMPONENTS>& signature, std::vector<EntityId>& relocated)
+	{
+		if (m_locations.size() <= entity)
+			m_locations.resize(static_cast<size_t>(entity) + 1, { InvalidArchetype, 0, 0 });
+
+		EntityLocation oldLocation = m_locations[entity];
+		Archetype* oldArchetype = oldLocation.archetype == InvalidArchetype ? nullptr : m_archetypes[oldLocation.archetype].get();
+		if (oldArchetype && oldArchetype->signature() == signature)
+			return;
+
+		if (signature.any())
+		{
+			uint32_t newIndex = archetype_index(signature);
+			Archetype& newArchetype = *m_archetypes[newIndex];
+
+			size_t chunk, row;
+			newArchetype.push_entity(entity, chunk, row);
+			for (ComponentTypeId id = 0; id < ECS_MAX_COMPONENTS; id++)
+			{
+				if (!signature.test(id))
+					continue;
+				void* dst = newArchetype.component(chunk, row, id);
+				if (oldArchetype && oldArchetype->has(id))
+					m_infos[id].relocate(dst, oldArchetype->component(oldLocation.chunk, oldLocation.row, id));
+				else
+					m_infos[id].construct(dst);
+			}
+			m_locations[entity] = { newIndex, static_cast<uint32_t>(chunk), static_cast<uint32_t>(row) };
+			relocated.push_back(entity);
+		}
+		else
+		{
+			m_locations[entity] = { InvalidArchetype, 0, 0 };
+		}
+
+		if (!oldArchetype)
+			return;
+
+		for (ComponentTypeId id = 0; id < ECS_MAX_COMPONENTS; id++)
+			if (oldArchetype->has(id) && !signature.test(id))
+				m_infos[id].destroy(oldArchetype->component(oldLocation.chunk, oldLocation.row, id));
+
+		EntityId movedEntity = 0;
+		if (oldArchetype->erase_row(oldLocation.chunk, oldLocation.row, movedEntity))
+		{
+			m_locations[movedEntity].chunk = oldLocation.chunk;
+			m_locations[movedEntity].row = oldLocation.row;
+			relocated.push_back(movedEntity);
+		}
+	}
+
+	template<typename... Ts, typename F, size_t... I>
+	void call_chunk(Archetype& archetype, size_t chunk, const std::array<ComponentTypeId, sizeof...(Ts)>& ids, F& fn, std::index_sequence<I...>)
+	{
+		fn(
+			archetype.chunk_size(chunk),
+			archetype.entities(chunk),
+			static_cast<Ts*>(archetype.column(chunk, ids[I]))...
+		);
+	}
+};
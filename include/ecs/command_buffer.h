@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// included from ecs.h before the ECSManager
+
+#ifndef ECS_COMMAND_BLOCK_SIZE
+#define ECS_COMMAND_BLOCK_SIZE 4096 // bytes per block of recorded component values
+#endif
+
+enum class EntityCommandType : uint8_t
+{
+	Create,
+	Delete,
+	AddComponent,
+	RemoveComponent
+};
+
+// applies a component command, defined after the ECSManager
+typedef void (*EntityCommandFn)(ECSManager& ecs, EntityId entity, void* payload);
+
+struct EntityCommand
+{
+	EntityCommandType type;
+	EntityId entity;
+	EntityCommandFn apply; // component commands only
+	void* payload; // recorded component value, destroyed by apply
+	void (*discard)(void* payload); // destroys a payload which never got applied
+};
+
+template<typename T> void apply_add_component_command(ECSManager& ecs, EntityId entity, void* payload);
+template<typename T> void apply_remove_component_command(ECSManager& ecs, EntityId entity, void* payload);
+
+// records structural changes of a single thread, the ECSManager applies all buffers at its sync point
+// component values are moved into blocks owned by the buffer, so recording doesn't allocate once warmed up
+class CommandBuffer
+{
+public:
+	CommandBuffer(ECSManager* ecs) :
+		m_ecs{ ecs }, m_block{ 0 }, m_offset{ 0 }
+	{}
+	CommandBuffer(const CommandBuffer&) = delete;
+	CommandBuffer& operator=(const CommandBuffer&) = delete;
+	~CommandBuffer()
+	{
+		discard();
+	}
+
+	// the id is reserved right away and can be used in the following commands
+	// the entity exists once the commands are applied
+	EntityId create_entity();
+	void delete_entity(EntityId entity)
+	{
+		m_commands.push_back({ EntityCommandType::Delete, entity, nullptr, nullptr, nullptr });
+	}
+	template<typename T> void add_component(EntityId entity, T component = T())
+	{
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "over aligned components can't be recorded");
+		void* payload = new (allocate(sizeof(T), alignof(T))) T(std::move(component));
+		m_commands.push_back({ EntityCommandType::AddComponent, entity, &apply_add_component_command<T>, payload, &discard_payload<T> });
+	}
+	template<typename T> void remove_component(EntityId entity)
+	{
+		m_commands.push_back({ EntityCommandType::RemoveComponent, entity, &apply_remove_component_command<T>, nullptr, nullptr });
+	}
+
+	const std::vector<EntityCommand>& commands() const
+	{
+		return m_commands;
+	}
+	bool empty() const
+	{
+		return m_commands.empty();
+	}
+	// forgets all commands, the payloads have to be applied or discarded already
+	void clear()
+	{
+		m_commands.clear();
+		m_largePayloads.clear();
+		m_block = 0;
+		m_offset = 0;
+	}
+	// destroys all payloads without applying them
+	void discard()
+	{
+		for (auto& command : m_commands)
+			if (command.payload && command.discard)
+				command.discard(command.payload);
+		clear();
+	}
+
+private:
+	ECSManager* m_ecs;
+	std::vector<EntityCommand> m_commands;
+
+	std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+	size_t m_block; // block currently written to
+	size_t m_offset; // bytes used in the current block
+	std::vector<std::unique_ptr<std::byte[]>> m_largePayloads; // values bigger than a block
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		if (size > ECS_COMMAND_BLOCK_SIZE)
+		{
+			m_largePayloads.emplace_back(new std::byte[size]);
+			return m_largePayloads.back().get();
+		}
+
+		m_offset = (m_offset + alignment - 1) & ~(alignment - 1);
+		if (m_block < m_blocks.size() && m_offset + size > ECS_COMMAND_BLOCK_SIZE)
+		{
+			m_block++;
+			m_offset = 0;
+		}
+		if (m_block == m_blocks.size())
+			m_blocks.emplace_back(new std::byte[ECS_COMMAND_BLOCK_SIZE]);
+
+		void* ptr = m_blocks[m_block].get() + m_offset;
+		m_offset += size;
+		return ptr;
+	}
+	template<typename T> static void discard_payload(void* payload)
+	{
+		static_cast<T*>(payload)->~T();
+	}
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// typed component events, included from ecs.h before the ComponentManager
+// the ComponentManager records them on structural changes and mutable accesses,
+// the ECSManager hands them to the observers once per frame as sorted spans of entity ids
+
+enum class ComponentEvent : uint8_t
+{
+	Added,
+	Removed,
+	Changed
+};
+#define ECS_COMPONENT_EVENT_COUNT 3
+
+typedef uint32_t ObserverId;
+typedef std::function<void(std::span<const EntityId> entities)> ObserverCallback;
+
+struct ComponentObserver
+{
+	ObserverId id;
+	ComponentTypeId type;
+	ComponentEvent event;
+	ObserverCallback callback;
+};
+
+// events of one component type since the last delivery, sorted and netted by collect
+struct ComponentEventBatch
+{
+	std::array<std::vector<EntityId>, ECS_COMPONENT_EVENT_COUNT> entities;
+
+	std::vector<EntityId>& operator[](ComponentEvent event) { return entities[static_cast<size_t>(event)]; }
+};
+
+// pending events of one component type, only events someone observes are recorded
+// adds and removals are logged together in order while either is observed, so collect can net them per entity
+class ComponentEventQueue
+{
+public:
+	ComponentEventQueue() : m_observed{ 0 } {}
+
+	bool observes(ComponentEvent event) const
+	{
+		return m_observed & bit(event);
+	}
+	bool observed() const
+	{
+		return m_observed != 0;
+	}
+	// adds and removals are recorded, both are needed to net either of them
+	bool records_membership() const
+	{
+		return m_observed & (bit(ComponentEvent::Added) | bit(ComponentEvent::Removed));
+	}
+	// events recorded before an event is observed are never delivered
+	void set_observed(ComponentEvent event, bool observed)
+	{
+		bool recordedMembership = records_membership();
+		if (observed)
+			m_observed |= bit(event);
+		else
+			m_observed &= ~bit(event);
+
+		if (event == ComponentEvent::Changed)
+			m_changed.clear();
+		else if (recordedMembership != records_membership())
+			m_membership.clear();
+	}
+
+	// an add or a removal, in the order they happen
+	void record(ComponentEvent event, EntityId entity)
+	{
+		m_membership.push_back({ entity, event });
+	}
+	// changes come from concurrently updated systems, each entity is recorded once per frame
+	void record_changed(EntityId entity)
+	{
+		std::lock_guard<std::mutex> lock(m_changedMutex);
+		m_changed.push_back(entity);
+	}
+
+	// moves the pending events into batch, every event list sorted and free of duplicates
+	// owns(entity) tells if the entity has the component now, the adds and removals of an entity are netted against
+	// whether it had the component before its first event: had and gone is removed, new and there is added,
+	// had and there again is removed and added, new and gone again is nothing
+	// added ones are not reported as changed and changed ones which are gone only as removed
+	template<typename F> void collect(ComponentEventBatch& batch, F&& owns)
+	{
+		for (auto& entities : batch.entities)
+			entities.clear();
+		auto& added = batch[ComponentEvent::Added];
+		auto& removed = batch[ComponentEvent::Removed];
+		auto& changed = batch[ComponentEvent::Changed];
+
+		// the events of an entity stay in the order they were recorded
+		std::stable_sort(m_membership.begin(), m_membership.end(), [](const MembershipEvent& a, const MembershipEvent& b) { return a.entity < b.entity; });
+		for (size_t i = 0; i < m_membership.size();)
+		{
+			EntityId entity = m_membership[i].entity;
+			bool ownedBefore = m_membership[i].event == ComponentEvent::Removed;
+			while (i < m_membership.size() && m_membership[i].entity == entity)
+				i++;
+
+			bool ownsNow = owns(entity);
+			if (ownedBefore)
+				removed.push_back(entity);
+			if (ownsNow)
+				added.push_back(entity);
+		}
+		m_membership.clear();
+
+		std::swap(changed, m_changed); // both keep their capacity
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+		std::erase_if(changed, [&](EntityId entity) { return !owns(entity) || std::binary_search(added.begin(), added.end(), entity); });
+
+		if (!observes(ComponentEvent::Added))
+			added.clear();
+		if (!observes(ComponentEvent::Removed))
+			removed.clear();
+	}
+
+private:
+	static uint8_t bit(ComponentEvent event)
+	{
+		return static_cast<uint8_t>(1u << static_cast<uint32_t>(event));
+	}
+
+	struct MembershipEvent
+	{
+		EntityId entity;
+		ComponentEvent event;
+	};
+
+	uint8_t m_observed; // bit per ComponentEvent
+	std::vector<MembershipEvent> m_membership; // adds and removals in recording order
+	std::vector<EntityId> m_changed;
+	std::mutex m_changedMutex;
+};
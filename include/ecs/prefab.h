@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// prefabs, included from ecs.h before the ComponentManager
+// a prefab is a frozen set of component values which ECSManager::instantiate copies into any number of new entities
+// trivially copyable values are copied bytewise, others copy assigned
+// heavy data like meshes is best kept behind a handle such as a std::shared_ptr, so instances share it instead of copying it
+
+typedef uint32_t PrefabId;
+
+// registers the component list of T, defined after the ComponentManager
+template<typename T> void ensure_prefab_component(ComponentManager& manager);
+
+struct PrefabComponent
+{
+	ComponentTypeId id;
+	std::shared_ptr<const void> value;
+	size_t size;
+	bool trivial; // trivially copyable, instances get a memcpy of value
+	void (*copy)(void* dst, const void* src); // copy assignment onto a default constructed component
+	void (*ensure)(ComponentManager& manager);
+};
+
+class Prefab
+{
+public:
+	// sets or replaces the value of T
+	template<typename T> Prefab& set(T value)
+	{
+		ComponentTypeId id = component_type_id<T>();
+		std::erase_if(m_components, [id](const PrefabComponent& component) { return component.id == id; });
+
+		PrefabComponent component;
+		component.id = id;
+		component.value = std::make_shared<const T>(std::move(value));
+		component.size = sizeof(T);
+		component.trivial = std::is_trivially_copyable_v<T>;
+		component.copy = [](void* dst, const void* src) { *static_cast<T*>(dst) = *static_cast<const T*>(src); };
+		component.ensure = &ensure_prefab_component<T>;
+		m_components.push_back(std::move(component));
+		m_signature.set(id, true);
+		return *this;
+	}
+	template<typename T> bool has() const
+	{
+		return m_signature.test(component_type_id<T>());
+	}
+	// the value of T, which has to be set
+	template<typename T> const T& get() const
+	{
+		ComponentTypeId id = component_type_id<T>();
+		auto it = std::find_if(m_components.begin(), m_components.end(), [id](const PrefabComponent& component) { return component.id == id; });
+		assert(it != m_components.end());
+		return *static_cast<const T*>(it->value.get());
+	}
+
+	const std::bitset<ECS_MAX_COMPONENTS>& signature() const
+	{
+		return m_signature;
+	}
+	const std::vector<PrefabComponent>& components() const
+	{
+		return m_components;
+	}
+
+private:
+	std::vector<PrefabComponent> m_components;
+	std::bitset<ECS_MAX_COMPONENTS> m_signature;
+};
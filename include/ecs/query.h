@@ -0,0 +1,113 @@
+#pragma once
+
+#include <bitset>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// included from ecs.h after the ComponentManager
+
+// cached set of all entities which own every component of a query
+// the ECSManager keeps it up to date on structural changes, so iterating never looks anything up
+class IQuery
+{
+public:
+	virtual ~IQuery() = default;
+
+	bool matches(const std::bitset<ECS_MAX_COMPONENTS>& components) const
+	{
+		return (components & m_signature) == m_signature;
+	}
+	bool uses(ComponentTypeId id) const
+	{
+		return m_signature.test(id);
+	}
+	bool contains(EntityId entity) const
+	{
+		return m_entities.contains(entity);
+	}
+	const SparseSet& entities() const
+	{
+		return m_entities;
+	}
+	size_t size() const
+	{
+		return m_entities.size();
+	}
+
+	virtual void insert(EntityId entity) = 0;
+	virtual void erase(EntityId entity) = 0;
+	// the components of the entity moved in memory
+	virtual void refresh(EntityId entity) = 0;
+
+protected:
+	std::bitset<ECS_MAX_COMPONENTS> m_signature;
+	SparseSet m_entities;
+};
+
+// const Ts are read only and never marked as changed
+template<typename... Ts>
+class Query : public IQuery
+{
+public:
+	Query(ComponentManager* componentManager) :
+		m_componentManager{ componentManager }
+	{
+		(m_signature.set(component_type_id<std::remove_const_t<Ts>>(), true), ...);
+	}
+
+	// calls fn(Ts&...) or fn(EntityId, Ts&...) for every entity of the query
+	template<typename F> void each(F&& fn)
+	{
+		for (size_t i = 0; i < m_components.size(); i++)
+			visit(i, fn);
+	}
+	// like each, but only for entities whose C changed after the tick
+	template<typename C, typename F> void each_changed(uint32_t tick, F&& fn)
+	{
+		for (size_t i = 0; i < m_components.size(); i++)
+			if (m_componentManager->changed_since<C>(m_entities[i], tick))
+				visit(i, fn);
+	}
+
+	void insert(EntityId entity) override
+	{
+		m_entities.insert(entity);
+		m_components.emplace_back(resolve(entity));
+	}
+	void erase(EntityId entity) override
+	{
+		uint32_t index = m_entities.erase(entity);
+		if (index == SparseSet::Null)
+			return;
+		m_components[index] = m_components.back();
+		m_components.pop_back();
+	}
+	void refresh(EntityId entity) override
+	{
+		m_components[m_entities.index(entity)] = resolve(entity);
+	}
+
+private:
+	ComponentManager* m_componentManager;
+	std::vector<std::tuple<Ts*...>> m_components; // parallel to the dense entity array
+
+	std::tuple<Ts*...> resolve(EntityId entity)
+	{
+		return std::tuple<Ts*...>(&m_componentManager->get_component<std::remove_const_t<Ts>>(entity)...);
+	}
+	template<typename F> void visit(size_t i, F& fn)
+	{
+		EntityId entity = m_entities[i];
+		if constexpr (std::is_invocable_v<F, EntityId, Ts&...>)
+			std::apply([&](Ts*... components) { fn(entity, *components...); }, m_components[i]);
+		else
+			std::apply([&](Ts*... components) { fn(*components...); }, m_components[i]);
+		(mark_changed<Ts>(entity), ...);
+	}
+	template<typename T> void mark_changed(EntityId entity)
+	{
+		if constexpr (!std::is_const_v<T>)
+			m_componentManager->mark_changed<T>(entity);
+	}
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+// included from ecs.h after the ISystem
+
+// groups the systems into levels of mutually non conflicting systems
+// a system always lands in a later level than every earlier registered system it conflicts with,
+// so running the levels in order gives the same result as running all systems in registration order
+class SystemScheduler
+{
+public:
+	static bool conflicting(const SystemAccess& a, const SystemAccess& b)
+	{
+		if (a.exclusive || b.exclusive)
+			return true;
+		if ((a.writes & (b.reads | b.writes)).any() || (b.writes & a.reads).any())
+			return true;
+		return (a.resources & b.resources) != 0;
+	}
+
+	void build(const std::vector<ISystem*>& systems)
+	{
+		m_levels.clear();
+
+		// level of a system = one after the latest level of all earlier conflicting systems
+		std::vector<size_t> systemLevels(systems.size(), 0);
+		for (size_t i = 0; i < systems.size(); i++)
+		{
+			for (size_t j = 0; j < i; j++)
+				if (conflicting(systems[i]->access(), systems[j]->access()))
+					systemLevels[i] = std::max(systemLevels[i], systemLevels[j] + 1);
+
+			if (m_levels.size() <= systemLevels[i])
+				m_levels.resize(systemLevels[i] + 1);
+			m_levels[systemLevels[i]].push_back(systems[i]);
+		}
+	}
+	const std::vector<std::vector<ISystem*>>& levels() const
+	{
+		return m_levels;
+	}
+
+	void dump(std::ostream& os) const
+	{
+		os << "system schedule (" << m_levels.size() << " levels)\n";
+		for (size_t level = 0; level < m_levels.size(); level++)
+		{
+			os << "level " << level << ":\n";
+			for (auto system : m_levels[level])
+			{
+				const auto& access = system->access();
+				os << "  " << system->type_name();
+				if (access.exclusive)
+				{
+					os << " [exclusive]\n";
+					continue;
+				}
+				os << " reads {";
+				for (ComponentTypeId id = 0; id < ECS_MAX_COMPONENTS; id++)
+					if (access.reads.test(id) && !access.writes.test(id))
+						os << " " << component_type_names()[id];
+				os << " } writes {";
+				for (ComponentTypeId id = 0; id < ECS_MAX_COMPONENTS; id++)
+					if (access.writes.test(id))
+						os << " " << component_type_names()[id];
+				os << " } resources " << access.resources << "\n";
+			}
+		}
+	}
+
+private:
+	std::vector<std::vector<ISystem*>> m_levels;
+};
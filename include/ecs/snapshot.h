@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+// binary snapshots of the ECS state, included from ecs.h before the component storages
+//
+// layout, native byte order, all offsets from the start of the file:
+// EcsSnapshotHeader
+// generation per entity slot, live entity ids, free entity ids
+// EcsSnapshotComponent per component list
+// per component list: the type name, the entity ids in storage order and the element ranges
+// every range starts ECS_SNAPSHOT_ALIGNMENT aligned and is padded to the range stride,
+// so the ranges of a copy on write mapping can be used as component storage directly
+
+#define ECS_SNAPSHOT_MAGIC "NVES"
+#define ECS_SNAPSHOT_VERSION 1
+#define ECS_SNAPSHOT_ALIGNMENT 64
+
+struct EcsSnapshotHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t rangeSize; // SPACE_CONSISTENT_VECTOR_RANGE_SIZE of the writer
+	uint32_t componentCount;
+	uint64_t entitySlots; // ids handed out so far, length of the generation table
+	uint64_t entityCount;
+	uint64_t freeCount;
+	uint64_t generationsOffset;
+	uint64_t entitiesOffset;
+	uint64_t freeOffset;
+	uint64_t componentsOffset;
+};
+
+struct EcsSnapshotComponent
+{
+	uint64_t nameOffset; // typeid name of the component, not null terminated
+	uint64_t nameLength;
+	uint64_t elementSize;
+	uint64_t count;
+	uint64_t rangeStride; // bytes from one range to the next
+	uint64_t entitiesOffset; // count entity ids, entity i owns element i
+	uint64_t dataOffset;
+};
+
+// sequential file writer which keeps track of the offset for the tables
+class EcsSnapshotWriter
+{
+public:
+	EcsSnapshotWriter(const std::string& path) :
+		m_file{ path, std::ios::binary | std::ios::trunc }, m_offset{ 0 }
+	{}
+
+	bool good() const
+	{
+		return m_file.good();
+	}
+	uint64_t offset() const
+	{
+		return m_offset;
+	}
+	void write(const void* data, size_t bytes)
+	{
+		m_file.write(static_cast<const char*>(data), bytes);
+		m_offset += bytes;
+	}
+	void pad(size_t bytes)
+	{
+		static const char zeros[ECS_SNAPSHOT_ALIGNMENT] = {};
+		for (; bytes > ECS_SNAPSHOT_ALIGNMENT; bytes -= ECS_SNAPSHOT_ALIGNMENT)
+			write(zeros, ECS_SNAPSHOT_ALIGNMENT);
+		write(zeros, bytes);
+	}
+	void align(size_t alignment)
+	{
+		pad((alignment - m_offset % alignment) % alignment);
+	}
+	// overwrites already written bytes, used for the tables which are only known at the end
+	void patch(uint64_t offset, const void* data, size_t bytes)
+	{
+		m_file.seekp(offset);
+		m_file.write(static_cast<const char*>(data), bytes);
+		m_file.seekp(m_offset);
+	}
+
+private:
+	std::ofstream m_file;
+	uint64_t m_offset;
+};
+
+// private copy on write mapping of a whole file, writes never reach the file
+// the platform code lives in snapshot.cpp, so the system headers stay out of ecs.h
+class MappedFile
+{
+public:
+	// nullptr if the file can't be mapped
+	static std::shared_ptr<MappedFile> open(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	std::byte* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	// the range lies inside the file
+	bool contains(uint64_t offset, uint64_t bytes) const
+	{
+		return offset <= m_size && bytes <= m_size - offset;
+	}
+
+private:
+	MappedFile();
+
+	std::byte* m_data;
+	size_t m_size;
+#ifdef _WIN32
+	void* m_file; // HANDLEs of the file and its mapping
+	void* m_mapping;
+#endif
+};
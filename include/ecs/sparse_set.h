@@ -0,0 +1,105 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifndef SPARSE_SET_PAGE_BITS
+#define SPARSE_SET_PAGE_BITS 12 // 4096 entries per sparse page
+#endif
+
+#define SPARSE_SET_PAGE_SIZE (1u << SPARSE_SET_PAGE_BITS)
+#define SPARSE_SET_PAGE_MASK (SPARSE_SET_PAGE_SIZE - 1)
+
+// maps dense integer keys (entity ids) to a packed index range [0, size)
+// the sparse side is split into lazily allocated pages, so large but sparse key ranges stay cheap
+// the dense side is the packed key array, removal swaps the last key into the hole
+class SparseSet
+{
+public:
+	typedef uint32_t Key;
+	static constexpr uint32_t Null = UINT32_MAX;
+
+	bool contains(Key key) const
+	{
+		size_t page = key >> SPARSE_SET_PAGE_BITS;
+		return page < m_sparse.size() && m_sparse[page] && m_sparse[page][key & SPARSE_SET_PAGE_MASK] != Null;
+	}
+	// dense index of a key, the key has to be contained
+	uint32_t index(Key key) const
+	{
+		assert(contains(key));
+		return m_sparse[key >> SPARSE_SET_PAGE_BITS][key & SPARSE_SET_PAGE_MASK];
+	}
+	// dense index of a key or Null
+	uint32_t find(Key key) const
+	{
+		return contains(key) ? index(key) : Null;
+	}
+
+	// appends the key to the dense array and returns its index
+	uint32_t insert(Key key)
+	{
+		assert(!contains(key));
+		uint32_t index = static_cast<uint32_t>(m_dense.size());
+		page(key)[key & SPARSE_SET_PAGE_MASK] = index;
+		m_dense.push_back(key);
+		return index;
+	}
+	// removes the key by moving the last key into its dense slot
+	// returns the dense index which was freed and now holds the former last key, Null if the key wasn't contained
+	uint32_t erase(Key key)
+	{
+		if (!contains(key))
+			return Null;
+		uint32_t index = this->index(key);
+		Key last = m_dense.back();
+
+		m_dense[index] = last;
+		m_sparse[last >> SPARSE_SET_PAGE_BITS][last & SPARSE_SET_PAGE_MASK] = index;
+		m_sparse[key >> SPARSE_SET_PAGE_BITS][key & SPARSE_SET_PAGE_MASK] = Null;
+		m_dense.pop_back();
+		return index;
+	}
+	void clear()
+	{
+		for (Key key : m_dense)
+			m_sparse[key >> SPARSE_SET_PAGE_BITS][key & SPARSE_SET_PAGE_MASK] = Null;
+		m_dense.clear();
+	}
+	void reserve(size_t size)
+	{
+		m_dense.reserve(size);
+	}
+
+	size_t size() const { return m_dense.size(); }
+	bool empty() const { return m_dense.empty(); }
+	Key operator[](size_t index) const { return m_dense[index]; }
+	Key front() const { return m_dense.front(); }
+	Key back() const { return m_dense.back(); }
+	const Key* data() const { return m_dense.data(); }
+	const std::vector<Key>& dense() const { return m_dense; }
+
+	std::vector<Key>::const_iterator begin() const { return m_dense.cbegin(); }
+	std::vector<Key>::const_iterator end() const { return m_dense.cend(); }
+
+private:
+	std::vector<std::unique_ptr<uint32_t[]>> m_sparse; // pages of key -> dense index
+	std::vector<Key> m_dense; // dense index -> key
+
+	uint32_t* page(Key key)
+	{
+		size_t page = key >> SPARSE_SET_PAGE_BITS;
+		if (m_sparse.size() <= page)
+			m_sparse.resize(page + 1);
+		if (!m_sparse[page])
+		{
+			m_sparse[page].reset(new uint32_t[SPARSE_SET_PAGE_SIZE]);
+			std::fill_n(m_sparse[page].get(), SPARSE_SET_PAGE_SIZE, Null);
+		}
+		return m_sparse[page].get();
+	}
+};
@@ -16,7 +16,7 @@ namespace math
 		quaternion(Vector4 v); // construct from (x, y, z, w) vector
 		quaternion(float angle, Vector3 axis); // quaternion to rotate angle (radians) around axis
 		quaternion(Vector3 dir, Vector3 up); // look direction
-		quaternion(const quaternion& quaternion); // copy constructor
+		quaternion(const quaternion& quaternion) = default; // trivial, so components holding quaternions stay trivially copyable
 
 		float x;
 		float y;
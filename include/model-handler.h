@@ -18,6 +18,7 @@
 #include "vulkan/buffer.h"
 #include "vulkan/pipeline.h"
 #include "ecs.h"
+#include "transform_hierarchy.h"
 #include "material.h"
 #include "math-core.h"
 
@@ -177,7 +178,7 @@ struct StaticModel : Model
 	
 };
 
-class StaticGeometryHandler : public GeometryHandler, System<StaticModel, Transform>
+class StaticGeometryHandler : public GeometryHandler, System<Read<StaticModel>, Read<Transform>>
 {
 public:
 
@@ -202,10 +203,15 @@ typedef uint64_t DynamicModelHashSum;
 
 struct DynamicModel : Model
 {
-	DynamicModelHashSum hashSum;
+	DynamicModelHashSum hashSum = 0; // 0 until known, prefab instances carry the one of their mesh
+	// vertices and indices shared between instances, m_children then only hold the materials
+	std::shared_ptr<const Model> sharedMesh;
 };
 
 DynamicModelHashSum hash_model(const DynamicModel& model);
+// instance template for prefabs which shares the mesh of model by handle and has its hash precomputed
+// the instances share the materials of model as well
+DynamicModel shared_mesh_model(const DynamicModel& model);
 
 struct DynamicModelInfo
 {
@@ -214,7 +220,7 @@ struct DynamicModelInfo
 	DynamicModelHashSum hashSum;
 };
 
-class DynamicGeometryHandler : public GeometryHandler, System<DynamicModel, Transform>
+class DynamicGeometryHandler : public GeometryHandler, System<Read<DynamicModel>, Read<Transform>>
 {
 public:
 
@@ -223,6 +229,7 @@ public:
 	void start() override;
 	void awake(EntityId entity) override;
 	void update(float dt) override;
+	void remove(EntityId entity) override;
 
 	std::vector<VkSemaphore> buffer_cpy_semaphores() override;
 	std::vector<VkFence> buffer_cpy_fences() override;
@@ -237,10 +244,17 @@ protected:
 private:
 
 	void add_model(DynamicModel& model, Transform& transform);
+	Transform world_transform(EntityId entity);
 
 	Buffer<Transform> m_transformBuffer;
 	bool m_updatedTransformDescriptorSets;
 
+	// world transforms in the order of m_transformEntities, only changed ones are copied
+	std::vector<Transform> m_transforms;
+	std::vector<EntityId> m_transformEntities;
+	bool m_membershipChanged; // set by awake and remove for created and deleted entities, by the observers for added and removed components
+	std::vector<EntityId> m_changedEntities; // filled by the change observers, may hold non members
+
 	std::vector<DynamicModelInfo> m_individualModels;
 	uint32_t m_modelCount;
 };
@@ -3,10 +3,14 @@
 #include <array>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <span>
 
 #include "ecs.h"
 #include "model-handler.h"
 #include "spatial_hash_grid.h"
+#include "space_consistent_vector.h"
+#include "thread_pool.h"
 #include "gui.h"
 
 #include "nve_types.h"
@@ -54,39 +58,158 @@ ImGui::DragFloat("density", &component.density);
 
 GUI_PRINT_COMPONENT_END
 
+#define PBD_PARTICLE_STORE_NONE UINT32_MAX
+
+// particles of the PBDSystem in structure of arrays layout, in the order of the system's entities
+// gathered from the PBDParticle components at the start of a frame and scattered back at its end,
+// in between the solver only works on these arrays
+class PBDParticleStore
+{
+public:
+      void gather(ECSManager* ecs, const std::vector<EntityId>& entities);
+      void scatter();
+
+      size_t size() const { return m_entities.size(); }
+      // constraints never move particles without an inverse mass, like a boundary
+      bool is_static(uint32_t index) const
+      {
+            return m_invMasses[index] == 0.f;
+      }
+      // store index of a particle, PBD_PARTICLE_STORE_NONE if it wasn't gathered
+      uint32_t index(EntityId entity) const
+      {
+            return entity < m_index.size() ? m_index[entity] : PBD_PARTICLE_STORE_NONE;
+      }
+
+      std::vector<EntityId> m_entities;
+      std::vector<PBDParticle*> m_components; // cold fields like radius and density
+      std::vector<Vec> m_positions; // at the start of the substep
+      std::vector<Vec> m_predicted; // integrated and then projected by the constraints
+      std::vector<Vec> m_velocities;
+      std::vector<float> m_invMasses;
+
+private:
+      std::vector<uint32_t> m_index; // by EntityId
+};
+
 enum ConstraintType { Equality, Inequality, InverseInequality };
 
-typedef std::vector<PBDParticle*> InParticles;
+// the particles of one constraint, positions and inverse masses are the ones of the particle store
+struct InParticles
+{
+      PBDParticleStore* store;
+      const uint32_t* indices;
+      size_t count;
+
+      size_t size() const { return count; }
+      Vec& position(size_t i) const { return store->m_predicted[indices[i]]; }
+      float invmass(size_t i) const { return store->m_invMasses[indices[i]]; }
+      PBDParticle& component(size_t i) const { return *store->m_components[indices[i]]; }
+};
 class Constraint
 {
 public:
       Constraint(Cardinality cardinality, std::vector<EntityId> entities, ECSManager* ecs);
+      virtual ~Constraint() = default;
 
-      const Cardinality m_cardinality;
+      // rebinds a pooled constraint to other particles, the vectors keep their capacity
+      // every other field is up to whoever acquired the constraint
+      void reset(std::span<const EntityId> entities);
+
+      Cardinality m_cardinality;
       float m_compliance;
       std::vector<EntityId> m_entities;
-      std::vector<PBDParticle*> m_particles;
+      std::vector<uint32_t> m_indices; // store index per entity, set by resolve
       std::vector<Vec> m_gradients;
       float m_scalingFactor;
 
       ConstraintType m_type;
       virtual float constraint(InParticles particles) = 0;
       virtual Vec constraint_gradient(size_t der, InParticles particles) = 0;
+
+      // looks up the particles in the store, false if one of them isn't part of it
+      bool resolve(const PBDParticleStore& store);
+      InParticles particles(PBDParticleStore& store) const
+      {
+            return { &store, m_indices.data(), m_indices.size() };
+      }
 };
 
+inline size_t next_constraint_type_id()
+{
+      static size_t next = 0;
+      return next++;
+}
+// dense id per constraint type, indexes the constraint pools of the PBDSystem
+template<typename C> size_t constraint_type_id()
+{
+      static const size_t id = next_constraint_type_id();
+      return id;
+}
+
+class IConstraintPool
+{
+public:
+      virtual ~IConstraintPool() = default;
+      virtual void clear() = 0;
+};
+// frame constraints of one type, reused by the next frame instead of being reallocated
+// the constraints never move when the pool grows, so pointers to them stay valid until the next clear
+template<typename C> class ConstraintPool : public IConstraintPool
+{
+public:
+      ConstraintPool() : m_used{ 0 } {}
+
+      // an unused constraint bound to entities, only constructed if no earlier frame needed this many
+      C& acquire(std::span<const EntityId> entities)
+      {
+            if (m_used == m_constraints.size())
+                  m_constraints.push_back(C());
+            C& constraint = m_constraints[m_used++];
+            constraint.reset(entities);
+            return constraint;
+      }
+      // hands all constraints back, their memory is kept
+      void clear() override
+      {
+            m_used = 0;
+      }
+      size_t size() const { return m_used; }
+      size_t capacity() const { return m_constraints.size(); }
+
+private:
+      space_consistent_vector<C> m_constraints; // the first m_used are in use
+      size_t m_used;
+};
+
+#define PBD_SOLVER_MAX_COLORS 64 // constraints which find no free color are solved serially after the colors
+#define PBD_SOLVER_NO_COLOR UINT8_MAX
+#define PBD_SOLVER_JOB_SIZE 256 // constraints per thread pool job
+
+// how xpbd_solve projects the constraints
+enum class PBDSolverMode
+{
+      Jacobi, // all constraints against the same positions, then all corrections applied
+      GraphColoring // Gauss-Seidel over batches of constraints sharing no particle, every batch in parallel
+};
+
+#include "pbd/constraint_batch.h"
+
 class PBDSystem;
 class ConstraintGenerator
 {
 public:
-      virtual std::vector<Constraint*> create(
-            EntityId particle, std::vector<EntityId> surrounding,
-            ECSManager* ecs
+      // acquires the constraints of particle with its surrounding particles through system.emplace_constraint
+      virtual void create(
+            EntityId particle, const std::vector<EntityId>& surrounding,
+            ECSManager* ecs, PBDSystem& system
       ) = 0;
 };
 
 class CollisionConstraint : public Constraint
 {
 public:
+      CollisionConstraint();
       CollisionConstraint(float distance, std::vector<EntityId> entities, ECSManager* ecs);
 
       float constraint(InParticles particles) override;
@@ -97,17 +220,18 @@ public:
 class CollisionConstraintGenerator : public ConstraintGenerator
 {
 public:
-      std::vector<Constraint*> create(
-            EntityId particle, std::vector<EntityId> surrounding,
-            ECSManager* ecs
+      void create(
+            EntityId particle, const std::vector<EntityId>& surrounding,
+            ECSManager* ecs, PBDSystem& system
       ) override;
 
       float m_radius;
 };
 
 #define PBD_GRID_SIZE 3.1f
+#define PBD_GRID_MODE SpatialHashGridMode::Compact // the grid is only queried when the neighbor lists get rebuilt
 
-class PBDSystem : System<PBDParticle, Transform>
+class PBDSystem : System<Write<PBDParticle>, Write<Transform>>
 {
 public:
       PBDSystem();
@@ -115,17 +239,58 @@ public:
       void awake(EntityId id) override;
       void update(float dt) override;
 
+      // persistent constraint owned by the system
       template<typename C> C* add_constraint(std::vector<EntityId> particles)
       {
-            m_constraints.emplace_back(new C(1.f, particles, m_ecs));
+            // the frame constraints belong to the pools, they are generated again next frame
+            m_constraints.resize(m_constraintStart);
+            m_constraintColors.resize(std::min(m_constraintColors.size(), m_constraintStart));
+
+            m_ownedConstraints.emplace_back(new C(1.f, particles, m_ecs));
+            m_constraints.push_back(m_ownedConstraints.back().get());
             m_constraintStart = m_constraints.size();
             return dynamic_cast<C*>(m_constraints.back());
       }
+      // constraint of type C for the current frame, taken from the pool of C, called by the generators
+      template<typename C> C& emplace_constraint(std::span<const EntityId> particles)
+      {
+            C& constraint = constraint_pool<C>().acquire(particles);
+            m_constraints.push_back(&constraint);
+            return constraint;
+      }
+      // statically dispatched constraints of one kind, persistent ones and the ones the generators add every frame
+      template<typename Kind, size_t Arity> ConstraintBatch<Kind, Arity>& constraint_batch()
+      {
+            size_t id = constraint_type_id<ConstraintBatch<Kind, Arity>>();
+            if (m_constraintBatchById.size() <= id)
+                  m_constraintBatchById.resize(id + 1, nullptr);
+            if (!m_constraintBatchById[id])
+            {
+                  m_constraintBatches.emplace_back(new ConstraintBatch<Kind, Arity>());
+                  m_constraintBatchById[id] = m_constraintBatches.back().get();
+            }
+            return static_cast<ConstraintBatch<Kind, Arity>&>(*m_constraintBatchById[id]);
+      }
+      template<typename C> ConstraintPool<C>& constraint_pool()
+      {
+            size_t id = constraint_type_id<C>();
+            if (m_constraintPools.size() <= id)
+                  m_constraintPools.resize(id + 1);
+            if (!m_constraintPools[id])
+                  m_constraintPools[id] = std::make_unique<ConstraintPool<C>>();
+            return static_cast<ConstraintPool<C>&>(*m_constraintPools[id]);
+      }
       void register_self_generating_constraint(ConstraintGenerator* generator);
 
+      // threads solving the color batches and rebuilding the grid, 1 does everything on the calling thread
+      void set_threads(int threads);
+
       float m_dampingConstant = 0.995f;
       int m_solverIterations = 5;
       int m_substeps = 1;
+      PBDSolverMode m_solverMode = PBDSolverMode::Jacobi;
+      // extra reach of the neighbor lists, they are rebuilt once a particle moved more than half of it
+      float m_neighborSkin = 0.5f;
 
 private:
       PBDParticle& get_particle(EntityId id);
@@ -144,17 +309,49 @@ private:
       void generate_constraints();
       std::vector<ConstraintGenerator*> m_constraintGenerators;
 
+      // verlet neighbor lists in compressed rows, row i belongs to the i-th entity of the system
+      // a row holds every particle within PBD_GRID_SIZE + skin of it at the last build, the particle itself included
+      void update_neighbors();
+      bool neighbors_outdated();
+      std::vector<EntityId> m_neighborEntities; // the system's entities at the last build
+      std::vector<Vec> m_neighborPositions; // at the last build
+      std::vector<uint32_t> m_neighborStart;
+      std::vector<EntityId> m_neighbors;
+      float m_neighborBuildSkin = 0.f;
+
       void solve_constraints();
 
       void solve_seidel_gauss();
       void xpbd_solve(float dt);
+      void solve_jacobi(float dt);
+      void solve_colored(float dt);
+      void solve_colored_range(uint32_t start, uint32_t end, float dt);
+      bool constraint_scaling(Constraint* constraint, InParticles particles, float dt);
+      void apply_constraint(Constraint* constraint, InParticles particles);
       void solve_sys();
 
-      std::vector<Constraint*> m_constraints;
+      // greedy coloring, persistent constraints keep their color while it stays valid, collision constraints are colored every frame
+      void color_constraints();
+      std::vector<uint8_t> m_constraintColors; // per constraint, PBD_SOLVER_NO_COLOR until colored
+      std::vector<uint64_t> m_particleColors; // per store index, colors of the constraints writing it
+      std::vector<uint32_t> m_colorStart; // compressed rows of constraint indices per color, the last row is the serial one
+      std::vector<uint32_t> m_colorOrder;
+      std::unique_ptr<ThreadPool> m_threadPool; // only with more than one thread
+
+      std::vector<Constraint*> m_constraints; // the persistent ones, then the ones of the current frame from m_constraintPools
       size_t m_constraintStart;
+      std::vector<std::unique_ptr<Constraint>> m_ownedConstraints;
+      std::vector<std::unique_ptr<IConstraintPool>> m_constraintPools; // by constraint_type_id
+      std::vector<std::unique_ptr<IConstraintBatch>> m_constraintBatches; // solved after m_constraints, in creation order
+      std::vector<IConstraintBatch*> m_constraintBatchById; // by constraint_type_id
+      std::vector<uint32_t> m_batchStart; // index of every batch's first constraint among all constraints, then the total
 
       SpatialHashGrid m_grid;
       void sync_grid(PBDParticle& particle, EntityId entity);
+      void sync_store_grid();
+
+      PBDParticleStore m_store;
+      std::vector<uint8_t> m_resolvedConstraints; // per constraint, all of its particles are in the store
 
       Profiler m_profiler;
 };
\ No newline at end of file
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// statically dispatched constraints, included from pbd.h after the virtual Constraint interface
+// a ConstraintBatch<Kind, Arity> keeps every constraint of one kind in flat arrays and solves them in tight loops,
+// Kind supplies the inlined kernel, Arity the particles per constraint or PBD_DYNAMIC_ARITY if it varies
+//
+// a kind looks like
+// struct Kind
+// {
+//       struct Params { ... }; // per constraint
+//       // constraint value, writes the gradient of every particle
+//       template<typename P> static float evaluate(const P& particles, const Params& params, Vec* gradients);
+// };
+
+#define PBD_DYNAMIC_ARITY 0
+
+// the particles of one batched constraint, the same accessors as InParticles
+template<size_t Arity> struct BatchParticles
+{
+      PBDParticleStore* store;
+      const uint32_t* indices;
+      size_t count;
+
+      size_t size() const
+      {
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  return count;
+            else
+                  return Arity;
+      }
+      Vec& position(size_t i) const { return store->m_predicted[indices[i]]; }
+      float invmass(size_t i) const { return store->m_invMasses[indices[i]]; }
+      PBDParticle& component(size_t i) const { return *store->m_components[indices[i]]; }
+};
+
+// xpbd scaling factor of a constraint with the given value and gradients, false if it is satisfied or degenerate
+template<typename P> bool xpbd_scaling_factor(
+      ConstraintType type, float error, const P& particles, const Vec* gradients,
+      float compliance, float dt, float& scalingFactor
+)
+{
+      if (
+            type == Inequality && error >= 0
+            || type == InverseInequality && error <= 0
+            )
+            return false;
+
+      float sqrGradientSum = 0;
+      Vec gradientSum{ 0.f };
+      for (size_t j = 0; j < particles.size(); j++)
+      {
+            gradientSum += gradients[j];
+            sqrGradientSum += particles.invmass(j) * glm::dot(gradients[j], gradients[j]);
+      }
+
+      sqrGradientSum += glm::dot(gradientSum, gradientSum);
+      sqrGradientSum += compliance / std::powf(dt, 2.f);
+
+      if (sqrGradientSum == 0.f)
+            return false;
+
+      float factor = error / (sqrGradientSum + .000001f);
+      if (factor != factor)
+            return false;
+      scalingFactor = factor;
+      return true;
+}
+// static particles are never written, the coloring ignores them, so constraints of one color may share them across threads
+template<typename P> void xpbd_apply(const P& particles, const Vec* gradients, float scalingFactor)
+{
+      for (size_t j = 0; j < particles.size(); j++)
+      {
+            float invmass = particles.invmass(j);
+            if (invmass != 0.f)
+                  particles.position(j) += -scalingFactor * invmass * gradients[j];
+      }
+}
+
+// greedy coloring passes of PBDSystem::color_constraints, shared by the virtual constraints and the batches
+// indices(i) is the span of store indices of constraint i, particleColors the colors every particle is written with so far
+// a persistent color is claimed again unless it clashes with an earlier one since the masses or members changed
+template<typename Indices> void claim_constraint_colors(
+      size_t persistentCount, const uint8_t* resolved, uint8_t* colors, Indices&& indices,
+      const PBDParticleStore& store, uint64_t* particleColors
+)
+{
+      for (size_t i = 0; i < persistentCount; i++)
+      {
+            if (!resolved[i] || colors[i] >= PBD_SOLVER_MAX_COLORS)
+                  continue;
+            uint64_t bit = uint64_t(1) << colors[i];
+            std::span<const uint32_t> particles = indices(i);
+            bool clash = std::any_of(particles.begin(), particles.end(), [&](uint32_t index) {
+                  return !store.is_static(index) && (particleColors[index] & bit);
+            });
+            if (clash)
+            {
+                  colors[i] = PBD_SOLVER_NO_COLOR;
+                  continue;
+            }
+            for (uint32_t index : particles)
+                  if (!store.is_static(index))
+                        particleColors[index] |= bit;
+      }
+}
+// the lowest color none of the particles is written with yet for every uncolored constraint
+template<typename Indices> void assign_constraint_colors(
+      size_t count, const uint8_t* resolved, uint8_t* colors, Indices&& indices,
+      const PBDParticleStore& store, uint64_t* particleColors
+)
+{
+      for (size_t i = 0; i < count; i++)
+      {
+            if (!resolved[i] || colors[i] != PBD_SOLVER_NO_COLOR)
+                  continue;
+            std::span<const uint32_t> particles = indices(i);
+
+            uint64_t used = 0;
+            for (uint32_t index : particles)
+                  if (!store.is_static(index))
+                        used |= particleColors[index];
+            colors[i] = static_cast<uint8_t>(std::countr_one(used));
+            if (colors[i] >= PBD_SOLVER_MAX_COLORS)
+                  continue;
+
+            uint64_t bit = uint64_t(1) << colors[i];
+            for (uint32_t index : particles)
+                  if (!store.is_static(index))
+                        particleColors[index] |= bit;
+      }
+}
+
+// what the PBDSystem needs of a batch, one virtual call per batch and pass instead of per constraint
+// first is the index of the batch's constraint 0 among all constraints of the system
+class IConstraintBatch
+{
+public:
+      virtual ~IConstraintBatch() = default;
+
+      // drops the constraints of the last frame, the persistent ones stay
+      virtual void clear() = 0;
+      virtual size_t size() const = 0;
+      // looks up the particles in the store, constraints with a particle that isn't part of it are skipped this frame
+      virtual void resolve(const PBDParticleStore& store) = 0;
+
+      virtual void claim_colors(const PBDParticleStore& store, uint64_t* particleColors) = 0;
+      virtual void assign_colors(const PBDParticleStore& store, uint64_t* particleColors) = 0;
+      // adds the resolved constraints per color to colorCounts
+      virtual void count_colors(uint32_t* colorCounts) const = 0;
+      virtual void order_colors(uint32_t* cursor, uint32_t* order, uint32_t first) const = 0;
+
+      // jacobi, every scaling factor against the same positions, then every correction
+      virtual void compute(PBDParticleStore& store, float dt) = 0;
+      virtual void apply(PBDParticleStore& store) = 0;
+      // gauss-seidel over the constraints order[0, count)
+      virtual void project(PBDParticleStore& store, const uint32_t* order, size_t count, uint32_t first, float dt) = 0;
+};
+
+template<typename Kind, size_t Arity> class ConstraintBatch : public IConstraintBatch
+{
+public:
+      typedef typename Kind::Params Params;
+
+      ConstraintBatch() : m_persistentCount{ 0 }
+      {
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  m_offsets.push_back(0);
+      }
+
+      // constraint of the current frame, gone after the next clear
+      void add(std::span<const EntityId> entities, const Params& params, ConstraintType type, float compliance)
+      {
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  m_offsets.push_back(static_cast<uint32_t>(m_entities.size() + entities.size()));
+            else
+                  assert(entities.size() == Arity);
+            m_entities.insert(m_entities.end(), entities.begin(), entities.end());
+            m_params.push_back(params);
+            m_types.push_back(type);
+            m_compliances.push_back(compliance);
+      }
+      // constraint solved every frame, the persistent constraints precede the frame's, which are dropped
+      void add_persistent(std::span<const EntityId> entities, const Params& params, ConstraintType type, float compliance)
+      {
+            clear();
+            add(entities, params, type, compliance);
+            m_persistentCount = size();
+      }
+
+      void clear() override
+      {
+            m_entities.resize(begin(m_persistentCount));
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  m_offsets.resize(m_persistentCount + 1);
+            m_params.resize(m_persistentCount);
+            m_types.resize(m_persistentCount);
+            m_compliances.resize(m_persistentCount);
+            m_colors.resize(std::min(m_colors.size(), m_persistentCount));
+      }
+      size_t size() const override
+      {
+            return m_params.size();
+      }
+      size_t persistent_size() const
+      {
+            return m_persistentCount;
+      }
+
+      void resolve(const PBDParticleStore& store) override
+      {
+            size_t count = size();
+            m_indices.resize(m_entities.size());
+            m_gradients.resize(m_entities.size());
+            m_resolved.resize(count);
+            m_scalingFactors.resize(count);
+            m_active.resize(count);
+
+            for (size_t i = 0; i < m_entities.size(); i++)
+                  m_indices[i] = store.index(m_entities[i]);
+            for (size_t i = 0; i < count; i++)
+            {
+                  auto particles = indices(i);
+                  m_resolved[i] = std::find(particles.begin(), particles.end(), PBD_PARTICLE_STORE_NONE) == particles.end();
+            }
+      }
+
+      void claim_colors(const PBDParticleStore& store, uint64_t* particleColors) override
+      {
+            m_colors.resize(size(), PBD_SOLVER_NO_COLOR);
+            claim_constraint_colors(m_persistentCount, m_resolved.data(), m_colors.data(), [this](size_t i) { return indices(i); }, store, particleColors);
+      }
+      void assign_colors(const PBDParticleStore& store, uint64_t* particleColors) override
+      {
+            assign_constraint_colors(size(), m_resolved.data(), m_colors.data(), [this](size_t i) { return indices(i); }, store, particleColors);
+      }
+      void count_colors(uint32_t* colorCounts) const override
+      {
+            for (size_t i = 0; i < size(); i++)
+                  if (m_resolved[i])
+                        colorCounts[m_colors[i]]++;
+      }
+      void order_colors(uint32_t* cursor, uint32_t* order, uint32_t first) const override
+      {
+            for (size_t i = 0; i < size(); i++)
+                  if (m_resolved[i])
+                        order[cursor[m_colors[i]]++] = first + static_cast<uint32_t>(i);
+      }
+
+      void compute(PBDParticleStore& store, float dt) override
+      {
+            for (size_t i = 0; i < size(); i++)
+                  m_active[i] = m_resolved[i] && scaling_factor(store, i, dt);
+      }
+      void apply(PBDParticleStore& store) override
+      {
+            for (size_t i = 0; i < size(); i++)
+                  if (m_active[i])
+                        xpbd_apply(particles(store, i), m_gradients.data() + begin(i), m_scalingFactors[i]);
+      }
+      void project(PBDParticleStore& store, const uint32_t* order, size_t count, uint32_t first, float dt) override
+      {
+            for (size_t k = 0; k < count; k++)
+            {
+                  size_t i = order[k] - first;
+                  if (scaling_factor(store, i, dt))
+                        xpbd_apply(particles(store, i), m_gradients.data() + begin(i), m_scalingFactors[i]);
+            }
+      }
+
+private:
+      size_t begin(size_t i) const
+      {
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  return m_offsets[i];
+            else
+                  return i * Arity;
+      }
+      size_t count(size_t i) const
+      {
+            if constexpr (Arity == PBD_DYNAMIC_ARITY)
+                  return m_offsets[i + 1] - m_offsets[i];
+            else
+                  return Arity;
+      }
+      std::span<const uint32_t> indices(size_t i) const
+      {
+            return { m_indices.data() + begin(i), count(i) };
+      }
+      BatchParticles<Arity> particles(PBDParticleStore& store, size_t i) const
+      {
+            return { &store, m_indices.data() + begin(i), count(i) };
+      }
+      bool scaling_factor(PBDParticleStore& store, size_t i, float dt)
+      {
+            auto constraintParticles = particles(store, i);
+            Vec* gradients = m_gradients.data() + begin(i);
+            float error = Kind::evaluate(constraintParticles, m_params[i], gradients);
+            return xpbd_scaling_factor(m_types[i], error, constraintParticles, gradients, m_compliances[i], dt, m_scalingFactors[i]);
+      }
+
+      // per constraint
+      std::vector<Params> m_params;
+      std::vector<ConstraintType> m_types;
+      std::vector<float> m_compliances;
+      std::vector<uint8_t> m_resolved;
+      std::vector<uint8_t> m_colors; // PBD_SOLVER_NO_COLOR until colored
+      std::vector<float> m_scalingFactors;
+      std::vector<uint8_t> m_active; // violated in the jacobi pass
+      size_t m_persistentCount;
+
+      // per constraint particle, constraint i owns [begin(i), begin(i) + count(i))
+      std::vector<EntityId> m_entities;
+      std::vector<uint32_t> m_indices; // store indices, set by resolve
+      std::vector<Vec> m_gradients;
+      std::vector<uint32_t> m_offsets; // only with PBD_DYNAMIC_ARITY, size() + 1 entries
+};
+
+// ---------------------------------------
+// KINDS
+// ---------------------------------------
+
+// keeps two particles at a distance
+struct DistanceKind
+{
+      struct Params
+      {
+            float distance;
+      };
+      template<typename P> static float evaluate(const P& particles, const Params& params, Vec* gradients)
+      {
+            Vec d = particles.position(0) - particles.position(1);
+            float length = glm::length(d);
+            Vec n = length != 0.f ? d / length : d;
+            gradients[0] = n;
+            gradients[1] = -n;
+            return length - params.distance;
+      }
+};
+
+// sphere collision of two particles, the same as CollisionConstraint
+// Inequality pushes them apart up to distance, InverseInequality pulls them together
+struct CollisionKind
+{
+      struct Params
+      {
+            float distance;
+      };
+      template<typename P> static float evaluate(const P& particles, const Params& params, Vec* gradients)
+      {
+            return DistanceKind::evaluate(particles, DistanceKind::Params{ params.distance }, gradients);
+      }
+};
+
+#ifdef PBD_3D
+#define PBD_VOLUME_ARITY 4
+#else
+#define PBD_VOLUME_ARITY 3
+#endif
+
+// keeps the signed volume of a tetrahedron, or the signed area of a triangle in 2d
+struct VolumeKind
+{
+      struct Params
+      {
+            float restVolume;
+      };
+      template<typename P> static float evaluate(const P& particles, const Params& params, Vec* gradients)
+      {
+            Vec e1 = particles.position(1) - particles.position(0);
+            Vec e2 = particles.position(2) - particles.position(0);
+#ifdef PBD_3D
+            Vec e3 = particles.position(3) - particles.position(0);
+            gradients[1] = glm::cross(e2, e3) / 6.f;
+            gradients[2] = glm::cross(e3, e1) / 6.f;
+            gradients[3] = glm::cross(e1, e2) / 6.f;
+            gradients[0] = -(gradients[1] + gradients[2] + gradients[3]);
+            return glm::dot(glm::cross(e1, e2), e3) / 6.f - params.restVolume;
+#else
+            gradients[1] = Vec(e2.y, -e2.x) / 2.f;
+            gradients[2] = Vec(-e1.y, e1.x) / 2.f;
+            gradients[0] = -(gradients[1] + gradients[2]);
+            return (e1.x * e2.y - e1.y * e2.x) / 2.f - params.restVolume;
+#endif
+      }
+};
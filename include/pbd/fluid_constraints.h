@@ -17,6 +17,7 @@ inline const char* KernelFunctionNames[] = { "Cubic Spline", "Cubic", "Spiky" };
 class SPHConstraint : public Constraint
 {
 public:
+      SPHConstraint();
       SPHConstraint(std::vector<EntityId> entities, ECSManager* ecs);
 
       float constraint(InParticles particles) override;
@@ -26,11 +27,21 @@ private:
 
 };
 
+// SPHConstraint as batch kind, particle 0 followed by its neighbors
+struct SPHDensityKind
+{
+      struct Params {};
+      static float evaluate(const BatchParticles<PBD_DYNAMIC_ARITY>& particles, const Params& params, Vec* gradients);
+};
+
 class SPHConstraintGenerator : public ConstraintGenerator
 {
 public:
-      std::vector<Constraint*> create(
-            EntityId particle, std::vector<EntityId> surrounding,
-            ECSManager* ecs
+      void create(
+            EntityId particle, const std::vector<EntityId>& surrounding,
+            ECSManager* ecs, PBDSystem& system
       ) override;
+
+private:
+      std::vector<EntityId> m_particles; // particle followed by its surrounding ones, reused for every particle
 };
\ No newline at end of file
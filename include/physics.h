@@ -74,7 +74,7 @@ bool colliding(AxisAlignedBoundingBox a, AxisAlignedBoundingBox b);
 
 void intersect_tri_tri(Triangle a, Triangle b, TriangleIntersection& info);
 
-class PhysicsSystem : System<Transform, Rigidbody>
+class PhysicsSystem : System<Write<Transform>, Write<Rigidbody>>
 {
 public:
 	void awake(EntityId entity) override;
@@ -22,6 +22,7 @@
 #include "ecs.h"
 #include "nve_types.h"
 #include "model-handler.h"
+#include "transform_hierarchy.h"
 #include "gizmos.h"
 #include "image.h"
 #include "thread_pool.h"
@@ -50,6 +51,8 @@ struct RenderConfig
 	std::vector<const char*> enabledInstanceLayers;
 
 	bool autoECSUpdate;
+	ComponentStorageMode ecsStorageMode;
+	int ecsSystemThreads; // > 1 updates non conflicting systems in parallel
 
 	std::string vulkanApplicationName;
 	uint32_t vulkanApplicationVersion;
@@ -60,7 +63,8 @@ struct RenderConfig
 		clearColor{ 0, 0, 0 },
 		enableValidationLayers{ true },
 		enabledInstanceLayers{ },
-		autoECSUpdate{ true }
+		autoECSUpdate{ true },
+		ecsStorageMode{ ComponentStorageMode::ComponentLists }, ecsSystemThreads{ 1 }
 	{}
 };
 
@@ -138,7 +142,11 @@ public:
 	// create an entity with a transform attached to it
 	EntityId create_empty_game_object();
 	// create an entity with a transform and a dynamic model with the given default model attached to it
+	// the mesh is loaded once and shared, the materials are the entity's own
 	EntityId create_default_model(DefaultModel::DefaultModel model);
+	// prefab of a transform and the default model, its instances share the mesh and the materials
+	// m_ecs.instantiate(default_model_prefab(model), count) spawns many identical models at once
+	PrefabId default_model_prefab(DefaultModel::DefaultModel model);
 
 	// rendering
 
@@ -218,9 +226,11 @@ private:
 	VkDebugUtilsMessengerEXT m_debugMessenger;
 
 	// model handling
+	TransformHierarchy m_transformHierarchy;
 	StaticGeometryHandler m_staticGeometryHandler;
 	DynamicGeometryHandler m_dynamicGeometryHandler;
 	GizmosHandler m_gizmosHandler;
+	std::unordered_map<DefaultModel::DefaultModel, PrefabId> m_defaultModelPrefabs;
 
 	vk::PipelineBatchCreator m_pipelineBatchCreator;
 
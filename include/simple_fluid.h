@@ -23,7 +23,7 @@ struct Particle
 #define SF_BOUNDING_WIDTH 16
 #define SF_BOUNDING_HEIGHT 9
 
-class SimpleFluid : System<Particle, Transform>
+class SimpleFluid : System<Write<Particle>, Write<Transform>>
 {
 public:
 	SimpleFluid();
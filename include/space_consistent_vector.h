@@ -1,95 +1,237 @@
 #pragma once
 
+#include <assert.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-#define SPACE_CONSISTENT_VECTOR_RANGE_SIZE 128
+#ifndef SPACE_CONSISTENT_VECTOR_RANGE_BITS
+#define SPACE_CONSISTENT_VECTOR_RANGE_BITS 7 // 128 elements per range
+#endif
+#ifndef SPACE_CONSISTENT_VECTOR_ALIGNMENT
+#define SPACE_CONSISTENT_VECTOR_ALIGNMENT 64 // byte alignment of every range, one cache line
+#endif
+
+#define SPACE_CONSISTENT_VECTOR_RANGE_SIZE (size_t(1) << SPACE_CONSISTENT_VECTOR_RANGE_BITS)
+#define SPACE_CONSISTENT_VECTOR_RANGE_MASK (SPACE_CONSISTENT_VECTOR_RANGE_SIZE - 1)
 
-template<typename T>
+// default source of the ranges, all ranges of one vector have the same size
+struct default_range_allocator
+{
+	void* allocate_range(size_t bytes, std::align_val_t alignment)
+	{
+		return ::operator new(bytes, alignment);
+	}
+	void deallocate_range(void* range, size_t bytes, std::align_val_t alignment)
+	{
+		::operator delete(range, alignment);
+	}
+};
+
+// vector made of fixed size ranges, elements never move when it grows
+// every range is a contiguous aligned array, so loops over for_each_range can be vectorized
+template<typename T, typename RangeAllocator = default_range_allocator>
 class space_consistent_vector
 {
 public:
+	template<bool Const>
+	class basic_iterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef std::conditional_t<Const, const T*, T*> pointer;
+		typedef std::conditional_t<Const, const T&, T&> reference;
+		typedef std::conditional_t<Const, const space_consistent_vector*, space_consistent_vector*> container_pointer;
+
+		basic_iterator() : m_vector{ nullptr }, m_index{ 0 } {}
+		basic_iterator(container_pointer vector, size_t index) : m_vector{ vector }, m_index{ index } {}
+		operator basic_iterator<true>() const { return basic_iterator<true>(m_vector, m_index); }
+
+		reference operator*() const { return m_vector->at(m_index); }
+		pointer operator->() const { return &m_vector->at(m_index); }
+		reference operator[](difference_type offset) const { return m_vector->at(m_index + offset); }
+
+		basic_iterator& operator++() { m_index++; return *this; }
+		basic_iterator operator++(int) { basic_iterator it = *this; m_index++; return it; }
+		basic_iterator& operator--() { m_index--; return *this; }
+		basic_iterator operator--(int) { basic_iterator it = *this; m_index--; return it; }
+		basic_iterator& operator+=(difference_type offset) { m_index += offset; return *this; }
+		basic_iterator& operator-=(difference_type offset) { m_index -= offset; return *this; }
+		basic_iterator operator+(difference_type offset) const { return basic_iterator(m_vector, m_index + offset); }
+		basic_iterator operator-(difference_type offset) const { return basic_iterator(m_vector, m_index - offset); }
+		friend basic_iterator operator+(difference_type offset, const basic_iterator& it) { return it + offset; }
+		difference_type operator-(const basic_iterator& other) const { return static_cast<difference_type>(m_index) - static_cast<difference_type>(other.m_index); }
+
+		bool operator==(const basic_iterator& other) const { return m_index == other.m_index; }
+		auto operator<=>(const basic_iterator& other) const { return m_index <=> other.m_index; }
+
+	private:
+		container_pointer m_vector;
+		size_t m_index;
+	};
+	typedef basic_iterator<false> iterator;
+	typedef basic_iterator<true> const_iterator;
+
+	space_consistent_vector() : m_size{ 0 } {}
+	explicit space_consistent_vector(RangeAllocator allocator) : m_allocator{ allocator }, m_size{ 0 } {}
+	space_consistent_vector(const space_consistent_vector& other) : m_allocator{ other.m_allocator }, m_size{ 0 }
+	{
+		reserve(other.size());
+		for (const T& element : other)
+			push_back(element);
+	}
+	space_consistent_vector(space_consistent_vector&& other) noexcept :
+		m_allocator{ other.m_allocator }, m_ranges{ std::move(other.m_ranges) }, m_size{ other.m_size }
+	{
+		other.m_ranges.clear();
+		other.m_size = 0;
+	}
+	space_consistent_vector& operator=(space_consistent_vector other)
+	{
+		std::swap(m_allocator, other.m_allocator);
+		std::swap(m_ranges, other.m_ranges);
+		std::swap(m_size, other.m_size);
+		return *this;
+	}
+	~space_consistent_vector()
+	{
+		clear();
+		for (T* range : m_ranges)
+			free_range(range);
+	}
+
 	// element access
 	T& at(size_t index)
 	{
-		size_t rangeIndex = static_cast<size_t>(index / SPACE_CONSISTENT_VECTOR_RANGE_SIZE);
-		index = index % SPACE_CONSISTENT_VECTOR_RANGE_SIZE;
-		return m_data[rangeIndex][index];
+		return m_ranges[index >> SPACE_CONSISTENT_VECTOR_RANGE_BITS][index & SPACE_CONSISTENT_VECTOR_RANGE_MASK];
+	}
+	const T& at(size_t index) const
+	{
+		return m_ranges[index >> SPACE_CONSISTENT_VECTOR_RANGE_BITS][index & SPACE_CONSISTENT_VECTOR_RANGE_MASK];
 	}
 	T& operator[](size_t index) { return at(index); }
-	T& front() { return m_data.front().front(); }
-	T& back() { return m_data.back().back(); }
+	const T& operator[](size_t index) const { return at(index); }
+	T& front() { return at(0); }
+	T& back() { return at(m_size - 1); }
 
 	// iterators
-	// iterator begin();
-	// iterator end();
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_size); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, m_size); }
+
+	// calls fn(std::span<T>) for every range in order, all but the last one hold SPACE_CONSISTENT_VECTOR_RANGE_SIZE elements
+	template<typename F> void for_each_range(F&& fn)
+	{
+		for (size_t start = 0, range = 0; start < m_size; start += SPACE_CONSISTENT_VECTOR_RANGE_SIZE, range++)
+			fn(std::span<T>(m_ranges[range], std::min(SPACE_CONSISTENT_VECTOR_RANGE_SIZE, m_size - start)));
+	}
+	template<typename F> void for_each_range(F&& fn) const
+	{
+		for (size_t start = 0, range = 0; start < m_size; start += SPACE_CONSISTENT_VECTOR_RANGE_SIZE, range++)
+			fn(std::span<const T>(m_ranges[range], std::min(SPACE_CONSISTENT_VECTOR_RANGE_SIZE, m_size - start)));
+	}
 
 	// capacity
-	const bool empty() { return size() == 0; }
-	const size_t size() { return m_size; }
-	const size_t capacity() { return m_data.size() * SPACE_CONSISTENT_VECTOR_RANGE_SIZE; }
+	bool empty() const { return m_size == 0; }
+	size_t size() const { return m_size; }
+	size_t capacity() const { return m_ranges.size() * SPACE_CONSISTENT_VECTOR_RANGE_SIZE; }
 	void reserve(size_t size) { while (capacity() < size) new_range(); }
 
 	// modifiers
+	// destroys all elements, the ranges are kept for reuse
 	void clear()
 	{
-		m_data.clear();
-		m_size = 0;
+		while (m_size > 0)
+			pop_back();
 	}
 	void insert(size_t pos, T element)
 	{
-		size_t cur = size() - 1;
-		push_back(at(cur));
-		while (cur > pos)
-			at(cur) = at(--cur);
-		at(pos) = element;
+		if (pos == m_size)
+		{
+			push_back(std::move(element));
+			return;
+		}
 
-		m_size++;
+		push_back(std::move(back()));
+		for (size_t cur = m_size - 2; cur > pos; cur--)
+			at(cur) = std::move(at(cur - 1));
+		at(pos) = std::move(element);
 	}
 	void erase(size_t pos)
 	{
-		size_t cur = pos;
-		while (cur < size() - 1)
-			at(cur) = at(++cur);
+		for (size_t cur = pos; cur + 1 < m_size; cur++)
+			at(cur) = std::move(at(cur + 1));
 		pop_back();
-
-		m_size--;
 	}
 	void push_back(T element)
 	{
-		if (m_data.empty() || m_data.back().size() == SPACE_CONSISTENT_VECTOR_RANGE_SIZE)
+		if (m_size == capacity())
 			new_range();
-		m_data.back().push_back(element);
-
+		new (&at(m_size)) T(std::move(element));
 		m_size++;
 	}
 	void pop_back()
 	{
-		m_data.back().pop_back();
-		if (m_data.back().empty())
-			m_data.pop_back();
-
+		back().~T();
 		m_size--;
 	}
 	void resize(size_t size)
 	{
-		size_t rangeCount = static_cast<size_t>(size / SPACE_CONSISTENT_VECTOR_RANGE_SIZE) + 1;
-		m_data.resize(rangeCount);
-		for (auto& range : m_data)
-			range.resize(SPACE_CONSISTENT_VECTOR_RANGE_SIZE);
-		m_data.back().resize(size % SPACE_CONSISTENT_VECTOR_RANGE_SIZE);
-
+		while (m_size > size)
+			pop_back();
+		reserve(size);
+		while (m_size < size)
+			push_back(T());
+	}
+	// copies count elements behind the last one with one memcpy per range
+	void append(const T* elements, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "append copies the raw bytes");
+		reserve(m_size + count);
+		while (count > 0)
+		{
+			size_t offset = m_size & SPACE_CONSISTENT_VECTOR_RANGE_MASK;
+			size_t copied = std::min(count, SPACE_CONSISTENT_VECTOR_RANGE_SIZE - offset);
+			std::memcpy(&at(m_size), elements, copied * sizeof(T));
+			elements += copied;
+			count -= copied;
+			m_size += copied;
+		}
+	}
+	// takes over full ranges holding size constructed elements, the vector has to be empty
+	// the ranges are handed to the allocator once they are no longer needed, like the ones it allocated itself
+	void adopt_ranges(std::span<T* const> ranges, size_t size)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "adopted elements are never constructed");
+		assert(m_size == 0 && size <= ranges.size() * SPACE_CONSISTENT_VECTOR_RANGE_SIZE);
+		m_ranges.insert(m_ranges.begin(), ranges.begin(), ranges.end());
 		m_size = size;
 	}
 
 private:
+	static constexpr std::align_val_t RangeAlignment{ std::max<size_t>(SPACE_CONSISTENT_VECTOR_ALIGNMENT, alignof(T)) };
 
 	void new_range()
 	{
-		m_data.push_back(std::vector<T>());
-		m_data.back().reserve(SPACE_CONSISTENT_VECTOR_RANGE_SIZE);
+		m_ranges.push_back(static_cast<T*>(m_allocator.allocate_range(SPACE_CONSISTENT_VECTOR_RANGE_SIZE * sizeof(T), RangeAlignment)));
+	}
+	void free_range(T* range)
+	{
+		m_allocator.deallocate_range(range, SPACE_CONSISTENT_VECTOR_RANGE_SIZE * sizeof(T), RangeAlignment);
 	}
 
-	std::vector<std::vector<T>> m_data;
+	RangeAllocator m_allocator;
+	std::vector<T*> m_ranges; // uninitialized storage of SPACE_CONSISTENT_VECTOR_RANGE_SIZE elements each
 	size_t m_size;
 
-};
\ No newline at end of file
+};
@@ -1,36 +1,190 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
 
 #include "ecs.h"
 #include "nve_types.h"
+#include "thread_pool.h"
+
+#define SPATIAL_HASH_GRID_NO_BUCKET SIZE_MAX
+#define SPATIAL_HASH_GRID_NO_SLOT UINT32_MAX
+#define SPATIAL_HASH_GRID_MIN_CELLS 1024 // hash table size of the compact mode, at least twice the particle count
+#define SPATIAL_HASH_GRID_MIN_JOB 4096 // particles per thread pool job of the compact rebuild
+#define SPATIAL_HASH_GRID_MIN_QUERY_JOB 256 // positions per thread pool job of a batched query
+#define SPATIAL_HASH_GRID_QUERY_BUCKETS 125 // buckets of a query kept on the stack, a radius of up to 2 cells
+
+enum class SpatialHashGridMode
+{
+      Buckets, // a vector per bucket, updated whenever a particle changes its bucket
+      Compact // positions only, sorted into one array by cell with a counting sort before the first query after a change
+};
 
 class SpatialHashGrid
 {
 public:
-      SpatialHashGrid(float gridSize);
-      std::vector<EntityId>& bucket_at(Vector3 pos);
-      std::vector<EntityId>& bucket_at(Vector2 pos);
+      SpatialHashGrid(float gridSize, SpatialHashGridMode mode = SpatialHashGridMode::Buckets);
+      std::span<const EntityId> bucket_at(Vector3 pos);
+      std::span<const EntityId> bucket_at(Vector2 pos);
 
       void surrounding_particles(Vector3 pos, std::vector<EntityId>& particles);
       void surrounding_particles(Vector2 pos, std::vector<EntityId>& particles);
+      // particles of every bucket a sphere of radius around pos may overlap, sorted and without duplicates
+      void surrounding_particles(Vector3 pos, float radius, std::vector<EntityId>& particles);
+      void surrounding_particles(Vector2 pos, float radius, std::vector<EntityId>& particles);
+
+      // calls fn(entity, sqrDistance) for every particle within radius of pos, each exactly once and in no particular order
+      // every bucket is visited once even if several cells hash to it, particles of other cells in it are filtered by their distance
+      template<typename F> void for_each_in_radius(Vector3 pos, float radius, F&& fn)
+      {
+            if (m_mode == SpatialHashGridMode::Compact && m_compactDirty)
+                  rebuild();
+
+            // the cells the sphere overlaps
+            int64_t low[3], high[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                  low[axis] = static_cast<int64_t>(std::floor((pos[axis] - radius) / m_gridSize));
+                  high[axis] = static_cast<int64_t>(std::floor((pos[axis] + radius) / m_gridSize));
+            }
+            size_t cellCount = static_cast<size_t>((high[0] - low[0] + 1) * (high[1] - low[1] + 1) * (high[2] - low[2] + 1));
+
+            std::array<size_t, SPATIAL_HASH_GRID_QUERY_BUCKETS> localBuckets;
+            std::vector<size_t> largeBuckets;
+            size_t* buckets = localBuckets.data();
+            if (cellCount > localBuckets.size())
+            {
+                  largeBuckets.resize(cellCount);
+                  buckets = largeBuckets.data();
+            }
+            size_t bucketCount = 0;
+            size_t tableSize = m_mode == SpatialHashGridMode::Compact ? m_cellCount : m_buckets.size();
+            for (int64_t x = low[0]; x <= high[0]; x++)
+                  for (int64_t y = low[1]; y <= high[1]; y++)
+                        for (int64_t z = low[2]; z <= high[2]; z++)
+                              buckets[bucketCount++] = hash_cell(x, y, z, tableSize);
+            std::sort(buckets, buckets + bucketCount);
+            bucketCount = std::unique(buckets, buckets + bucketCount) - buckets;
+
+            const float sqrRadius = radius * radius;
+            for (size_t i = 0; i < bucketCount; i++)
+            {
+                  if (m_mode == SpatialHashGridMode::Compact)
+                  {
+                        for (uint32_t slot = m_cellStart[buckets[i]]; slot < m_cellStart[buckets[i] + 1]; slot++)
+                        {
+                              Vector3 d = m_sortedPositions[slot] - pos;
+                              float sqrDistance = glm::dot(d, d);
+                              if (sqrDistance <= sqrRadius)
+                                    fn(m_sortedEntities[slot], sqrDistance);
+                        }
+                  }
+                  else
+                  {
+                        for (EntityId entity : m_buckets[buckets[i]])
+                        {
+                              Vector3 d = m_particlePositions[entity] - pos;
+                              float sqrDistance = glm::dot(d, d);
+                              if (sqrDistance <= sqrRadius)
+                                    fn(entity, sqrDistance);
+                        }
+                  }
+            }
+      }
+      template<typename F> void for_each_in_radius(Vector2 pos, float radius, F&& fn)
+      {
+            for_each_in_radius(vec23(pos), radius, std::forward<F>(fn));
+      }
+      // for_each_in_radius for every position, calls fn(query, entity, sqrDistance) with query the index into positions
+      // the queries are split into contiguous ranges answered in parallel, the calls for one query come from one thread in a row
+      template<typename V, typename F> void for_each_in_radius(std::span<const V> positions, float radius, F&& fn)
+      {
+            // the jobs only read the grid
+            if (m_mode == SpatialHashGridMode::Compact && m_compactDirty)
+                  rebuild();
+
+            auto answer = [&](size_t start, size_t end) {
+                  for (size_t query = start; query < end; query++)
+                        for_each_in_radius(positions[query], radius, [&](EntityId entity, float sqrDistance) { fn(query, entity, sqrDistance); });
+            };
+
+            size_t count = positions.size();
+            size_t jobs = m_threadPool ? std::min<size_t>(m_threads, std::max<size_t>(1, count / SPATIAL_HASH_GRID_MIN_QUERY_JOB)) : 1;
+            if (jobs == 1)
+            {
+                  answer(0, count);
+                  return;
+            }
+            size_t jobSize = (count + jobs - 1) / jobs;
+            for (size_t start = 0; start < count; start += jobSize)
+            {
+                  size_t end = std::min(count, start + jobSize);
+                  m_threadPool->doJob([&answer, start, end]() { answer(start, end); });
+            }
+            m_threadPool->wait_for_finish();
+      }
 
       void insert_particle(Vector3 pos, EntityId id);
       void insert_particle(Vector2 pos, EntityId id);
 
       void change_particle(Vector3 oldPos, Vector3 newPos, EntityId id);
       void change_particle(Vector2 oldPos, Vector2 newPos, EntityId id);
+      // moves the particle from the bucket it was last inserted into, inserts it if it isn't yet
+      void move_particle(Vector3 pos, EntityId id);
+      void move_particle(Vector2 pos, EntityId id);
 
       void remove_particle(Vector3 pos, EntityId id);
       void remove_particle(Vector2 pos, EntityId id);
+      // removes the particle from the bucket it was last inserted into, for particles whose position is gone
+      void remove_particle(EntityId id);
+
+      // sorts the particles into the cells in compact mode, queries call it themselves after a change
+      void rebuild();
+      // threads of the compact rebuild, 1 rebuilds on the calling thread
+      void set_threads(int threads);
+      SpatialHashGridMode mode() const { return m_mode; }
 
       void print_buckets(Vector2 max);
 
 private:
       const float m_gridSize;
-      std::vector<std::vector<EntityId>> m_buckets;
-      size_t hash_vec(Vector3 v);
+      const SpatialHashGridMode m_mode;
+      size_t hash_vec(Vector3 v, size_t tableSize);
+      size_t hash_cell(int64_t x, int64_t y, int64_t z, size_t tableSize) const
+      {
+            int64_t size = static_cast<int64_t>(tableSize);
+            return static_cast<size_t>(((x * 73856093 ^ y * 19349663 ^ z * 83492791) % size + size) % size);
+      }
       size_t bucket_index(Vector3 v);
+
+      // buckets mode
+      std::vector<std::vector<EntityId>> m_buckets;
+      std::vector<size_t> m_particleBuckets; // bucket index per entity, SPATIAL_HASH_GRID_NO_BUCKET if not inserted
+      std::vector<Vector3> m_particlePositions; // last position per entity
+
+      // compact mode, the particles of cell c are m_sortedEntities[m_cellStart[c], m_cellStart[c + 1])
+      std::vector<EntityId> m_compactEntities; // inserted particles in insertion order
+      std::vector<Vector3> m_compactPositions;
+      std::vector<uint32_t> m_compactSlots; // index into m_compactEntities per entity, SPATIAL_HASH_GRID_NO_SLOT if not inserted
+      std::vector<uint32_t> m_compactCells; // cell per inserted particle at the last rebuild
+      std::vector<uint32_t> m_cellStart;
+      std::vector<EntityId> m_sortedEntities;
+      std::vector<Vector3> m_sortedPositions; // parallel to m_sortedEntities
+      std::vector<std::vector<uint32_t>> m_jobCounts; // particles per cell of every rebuild job, then their first slot
+      size_t m_cellCount;
+      bool m_compactDirty;
+      std::unique_ptr<ThreadPool> m_threadPool; // only with more than one thread
+      int m_threads;
+
+      void compact_set(Vector3 pos, EntityId id);
+      void compact_count(size_t job, size_t start, size_t end);
+      void compact_scatter(size_t job, size_t start, size_t end);
 };
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "ecs.h"
+#include "nve_types.h"
+#include "math-core.h"
+#include "thread_pool.h"
+
+#include "gui.h"
+
+#ifndef TRANSFORM_HIERARCHY_BATCH_SIZE
+#define TRANSFORM_HIERARCHY_BATCH_SIZE 1024 // minimum entities per job when root subtrees are updated in parallel
+#endif
+
+#define TRANSFORM_HIERARCHY_NO_PARENT UINT32_MAX
+
+// attaches the entity to another one, its Transform is then relative to the parent's world transform
+struct Parent
+{
+	EntityId entity;
+};
+
+GUI_PRINT_COMPONENT_START(Parent)
+
+ImGui::Text("parent entity %u", component.entity);
+
+GUI_PRINT_COMPONENT_END
+
+// written by the TransformHierarchy, entities without one are treated as roots whose world transform is their Transform
+struct WorldTransform
+{
+	glm::mat4 matrix;
+
+	// decomposition of the matrix for the renderer, shear from non uniformly scaled rotated parents is dropped
+	Vector3 position;
+	Vector3 scale;
+	Quaternion rotation;
+};
+
+GUI_PRINT_COMPONENT_START(WorldTransform)
+
+ImGui_DragVector("world position", component.position);
+ImGui_DragVector("world scale", component.scale);
+
+GUI_PRINT_COMPONENT_END
+
+WorldTransform compose_world_transform(const WorldTransform& parent, const Transform& local);
+WorldTransform root_world_transform(const Transform& local);
+
+// computes the WorldTransform of every entity with a Transform and a WorldTransform
+// the entities are kept in depth first order, so every parent precedes its children and every root subtree is contiguous
+// only subtrees below a changed Transform are recomputed, independent root subtrees are updated in parallel
+class TransformHierarchy : System<Read<Transform>, Write<WorldTransform>>
+{
+public:
+	TransformHierarchy();
+
+	void update(float dt) override;
+
+	// threads used for the root subtrees, 1 updates everything on the calling thread
+	void set_threads(int threads);
+
+private:
+	// hierarchy in depth first order, all indexed by position in m_order
+	std::vector<EntityId> m_order;
+	std::vector<uint32_t> m_parentIndex; // TRANSFORM_HIERARCHY_NO_PARENT for roots
+	std::vector<WorldTransform> m_world;
+	std::vector<uint8_t> m_dirty;
+	std::vector<std::pair<uint32_t, uint32_t>> m_batches; // [start, end) ranges of whole root subtrees
+
+	// state the order was built from
+	std::vector<EntityId> m_orderEntities;
+	std::vector<EntityId> m_orderParents; // parent per entity of m_orderEntities, the entity itself for roots
+
+	uint32_t m_tick;
+	std::unique_ptr<ThreadPool> m_threadPool; // only with more than one thread
+
+	bool hierarchy_changed();
+	void build_order();
+	void update_range(uint32_t start, uint32_t end, bool all);
+	EntityId parent_of(EntityId entity);
+};
@@ -123,6 +123,23 @@ public:
         }
         return reload;
     }
+    // sets the data without comparing it, the caller tracks whether it changed
+    bool set(const std::vector<T>& data, bool changed)
+    {
+        if (!m_initialized || data.size() == 0)
+            return false;
+
+        bool recreate = data.size() > m_data.size() || !m_created;
+        if (!changed && !recreate && data.size() == m_data.size())
+            return false;
+
+        m_realSize = sizeof(T) * data.size();
+        if (recreate)
+            create();
+        m_data = data;
+        reload_data();
+        return true;
+    }
     void cpy_raw(uint32_t size, const T* data)
     {
         m_realSize = sizeof(T) * size;
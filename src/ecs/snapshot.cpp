@@ -0,0 +1,75 @@
+#include "ecs/snapshot.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+	m_data{ nullptr }, m_size{ 0 }
+#ifdef _WIN32
+	, m_file{ INVALID_HANDLE_VALUE }, m_mapping{ nullptr }
+#endif
+{}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+	std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+	file->m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file->m_file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file->m_file, &size) || size.QuadPart == 0)
+		return nullptr;
+	file->m_size = static_cast<size_t>(size.QuadPart);
+	file->m_mapping = CreateFileMappingA(file->m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!file->m_mapping)
+		return nullptr;
+	file->m_data = static_cast<std::byte*>(MapViewOfFile(file->m_mapping, FILE_MAP_COPY, 0, 0, 0));
+	if (!file->m_data)
+		return nullptr;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	file->m_size = static_cast<size_t>(info.st_size);
+	void* data = mmap(nullptr, file->m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file referenced
+	if (data == MAP_FAILED)
+		return nullptr;
+	file->m_data = static_cast<std::byte*>(data);
+#endif
+	return file;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+#else
+	if (m_data)
+		munmap(m_data, m_size);
+#endif
+}
@@ -31,10 +31,7 @@ void GizmosHandler::awake(EntityId entity)
 void GizmosHandler::update(float dt)
 {
 	GeometryHandler::update();
-	while (!m_entities.empty())
-	{
-		m_ecs->delete_entity(m_entities.back());
-	}
+	m_ecs->delete_entities(m_entities.dense());
 }
 void GizmosHandler::remove(EntityId entity)
 {
@@ -40,7 +40,7 @@ void GUIManager::draw_entity_info()
 					auto componentType = m_ecs->m_componentManager.m_components[i]->print_type();
 					if (ImGui::TreeNode(componentType.c_str()))
 					{
-						m_ecs->m_componentManager.m_components[i]->gui_show_component(entity);
+						m_ecs->m_componentManager.gui_show_component(entity, static_cast<ComponentTypeId>(i));
 						ImGui::TreePop();
 					}
 				}
@@ -77,11 +77,13 @@ void GUIManager::draw_system_info()
 				std::stringstream label; label << "Entity " << entity;
 				if (ImGui::TreeNode(label.str().c_str()))
 				{
-					for (auto typeName : system->component_types())
+					const auto typeNames = system->component_types();
+					const auto typeIds = system->component_type_ids();
+					for (size_t i = 0; i < typeIds.size(); i++)
 					{
-						if (ImGui::TreeNode(typeName))
+						if (ImGui::TreeNode(typeNames[i]))
 						{
-							m_ecs->m_componentManager.m_components[m_ecs->m_componentManager.m_typeToId[typeName]]->gui_show_component(entity);
+							m_ecs->m_componentManager.gui_show_component(entity, typeIds[i]);
 							ImGui::TreePop();
 						}
 					}
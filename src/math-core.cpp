@@ -105,10 +105,6 @@ namespace math
 			qx, qy, qz, -qw
 		).normalized();
 	}
-	quaternion::quaternion(const quaternion& quaternion)
-	{
-		set(quaternion.x, quaternion.y, quaternion.z, quaternion.w);
-	}
 
 	// --------------------------------
 	// METHODS
@@ -626,6 +626,7 @@ void GeometryHandler::update()
 StaticGeometryHandler::StaticGeometryHandler()
 {
 	m_subpassCount = 1;
+	declare_resource(ECS_RESOURCE_RENDERER);
 }
 void StaticGeometryHandler::load_dummy_model()
 {
@@ -738,6 +739,8 @@ void StaticGeometryHandler::update(float dt)
 DynamicGeometryHandler::DynamicGeometryHandler()
 {
 	m_subpassCount = 0;
+	declare_read<WorldTransform>();
+	declare_resource(ECS_RESOURCE_RENDERER);
 }
 void DynamicGeometryHandler::start()
 {
@@ -745,28 +748,67 @@ void DynamicGeometryHandler::start()
 	bufferConfig.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 	m_transformBuffer.initialize(bufferConfig);
 	m_updatedTransformDescriptorSets = false;
+	m_membershipChanged = true;
 
 	m_modelCount = 0;
+
+	// joins, leaves and moved entities arrive as events, so the update doesn't look at every entity
+	auto membershipChanged = [this](std::span<const EntityId> entities) { m_membershipChanged = true; };
+	m_ecs->on_add<Transform>(membershipChanged);
+	m_ecs->on_add<DynamicModel>(membershipChanged);
+	m_ecs->on_remove<Transform>(membershipChanged);
+	m_ecs->on_remove<DynamicModel>(membershipChanged);
+
+	auto transformChanged = [this](std::span<const EntityId> entities) { m_changedEntities.insert(m_changedEntities.end(), entities.begin(), entities.end()); };
+	m_ecs->on_change<Transform>(transformChanged);
+	m_ecs->on_change<WorldTransform>(transformChanged);
+	m_ecs->on_add<WorldTransform>(transformChanged);
+	m_ecs->on_remove<WorldTransform>(transformChanged);
 }
 void DynamicGeometryHandler::awake(EntityId entity)
 {
 	auto& transform = m_ecs->get_component<Transform>(entity);
 	auto& model = m_ecs->get_component<DynamicModel>(entity);
 	add_model(model, transform);
+	// awake and remove run right away, a delete and a create reusing the id in one frame reorder the members at the same size
+	m_membershipChanged = true;
+}
+void DynamicGeometryHandler::remove(EntityId entity)
+{
+	m_membershipChanged = true;
 }
 void DynamicGeometryHandler::update(float dt)
 {
 	m_profiler.begin_label("dyn update");
 	PROFILE_START("get transforms")
-	// get all transforms
-	std::vector<Transform> transforms(m_entities.size());
-	for (size_t i = 0; i < m_entities.size(); i++)
-		transforms[i] = m_ecs->get_component<Transform>(m_entities[i]);
+	// get all transforms when entities joined or left, otherwise only the ones of the last change events
+	bool changed = m_membershipChanged;
+	if (changed)
+	{
+		m_transformEntities = m_entities.dense();
+		m_transforms.resize(m_entities.size());
+		for (size_t i = 0; i < m_entities.size(); i++)
+			m_transforms[i] = world_transform(m_entities[i]);
+		m_membershipChanged = false;
+	}
+	else
+	{
+		for (EntityId entity : m_changedEntities)
+		{
+			// members which joined through an added component during this frame's updates are picked up with their event
+			if (m_entities.contains(entity) && m_entities.index(entity) < m_transforms.size())
+			{
+				m_transforms[m_entities.index(entity)] = world_transform(entity);
+				changed = true;
+			}
+		}
+	}
+	m_changedEntities.clear();
 	PROFILE_END("get transforms");
 
 	PROFILE_START("push transforms");
 	// push transforms
-	bool updateDescriptorSet = m_transformBuffer.set(transforms);
+	bool updateDescriptorSet = m_transformBuffer.set(m_transforms, changed);
 	PROFILE_END("push transforms");
 
 	PROFILE_START("update base handler");
@@ -884,9 +926,22 @@ void DynamicGeometryHandler::record_command_buffer(uint32_t subpass, size_t fram
 
 	// ---------------------------------------
 }
+// the precomputed world transform of attached entities, the local one of entities outside the hierarchy
+Transform DynamicGeometryHandler::world_transform(EntityId entity)
+{
+	Transform transform = m_ecs->read_component<Transform>(entity);
+	if (m_ecs->used_components(entity).test(component_type_id<WorldTransform>()))
+	{
+		const auto& world = m_ecs->read_component<WorldTransform>(entity);
+		transform.position = world.position;
+		transform.scale = world.scale;
+		transform.rotation = world.rotation;
+	}
+	return transform;
+}
 void DynamicGeometryHandler::add_model(DynamicModel& model, Transform& transform)
 {
-	auto hashSum = hash_model(model);
+	auto hashSum = model.hashSum != 0 ? model.hashSum : hash_model(model);
 
 	bool newMeshGroup = true;
 	for (auto& modelInfo : m_individualModels)
@@ -901,7 +956,24 @@ void DynamicGeometryHandler::add_model(DynamicModel& model, Transform& transform
 	GeometryHandler::add_material(model, transform, GEOMETRY_HANDLER_INDEPENDENT_MATERIALS);
 	if (newMeshGroup)
 	{
-		GeometryHandler::add_model(model, true);
+		if (model.sharedMesh)
+		{
+			// the group gets its own copy of the shared vertices with the materials of this instance
+			Model mesh = *model.sharedMesh;
+			for (uint32_t i = 0; i < mesh.m_children.size(); i++)
+			{
+				mesh.m_children[i].material = model.m_children[i].material;
+				for (auto& v : mesh.m_children[i].vertices)
+					v.material = i;
+			}
+			GeometryHandler::add_model(mesh, true);
+			for (size_t i = 0; i < mesh.m_children.size(); i++)
+				model.m_children[i].id = mesh.m_children[i].id;
+		}
+		else
+		{
+			GeometryHandler::add_model(model, true);
+		}
 		DynamicModelInfo newModelInfo = {};
 		newModelInfo.hashSum = hashSum;
 		newModelInfo.instanceCount = 1;
@@ -927,9 +999,12 @@ std::vector<VkDescriptorSetLayoutBinding> DynamicGeometryHandler::other_descript
 
 DynamicModelHashSum hash_model(const DynamicModel& model)
 {
+	// the geometry of shared meshes lives in the handle, the materials always in the model
+	const Model& mesh = model.sharedMesh ? *model.sharedMesh : model;
 	DynamicModelHashSum hashSum = 263357457;
-	for (auto child : model.m_children)
+	for (size_t i = 0; i < mesh.m_children.size(); i++)
 	{
+		const auto& child = mesh.m_children[i];
 		for (auto index : child.indices)
 		{
 			if (index >= child.vertices.size())
@@ -937,10 +1012,20 @@ DynamicModelHashSum hash_model(const DynamicModel& model)
 			hashSum ^= (DynamicModelHashSum) (child.vertices[index].pos.x * 23626325 + child.vertices[index].pos.y * 9738346 + child.vertices[index].pos.z * 283756898967) * index + 2355901;
 			hashSum >>= 11;
 		}
-		hashSum ^= (DynamicModelHashSum) child.material->m_shader.get();
+		hashSum ^= (DynamicModelHashSum) model.m_children[i].material->m_shader.get();
 	}
 	return hashSum;
 }
+DynamicModel shared_mesh_model(const DynamicModel& model)
+{
+	DynamicModel instance;
+	instance.sharedMesh = model.sharedMesh ? model.sharedMesh : std::make_shared<const Model>(model);
+	instance.m_children.resize(model.m_children.size());
+	for (size_t i = 0; i < model.m_children.size(); i++)
+		instance.m_children[i].material = model.m_children[i].material;
+	instance.hashSum = hash_model(instance);
+	return instance;
+}
 
 // ------------------------------------------
 // TINY OBJ LOADER HELPER
@@ -1,5 +1,6 @@
 #include "pbd.h"
 
+#include <bit>
 #include <numeric>
 
 // #include <linalg/gsl_linalg.h>
@@ -11,8 +12,12 @@ PBDParticle::PBDParticle() :
 {}
 
 PBDSystem::PBDSystem() :
-      m_grid{ PBD_GRID_SIZE }, m_constraintStart{ 0 }
-{}
+      m_grid{ PBD_GRID_SIZE, PBD_GRID_MODE }, m_constraintStart{ 0 }
+{
+      // particle colors and gizmo lines
+      declare_write<DynamicModel>();
+      declare_resource(ECS_RESOURCE_RENDERER);
+}
 
 void PBDSystem::awake(EntityId id)
 {
@@ -23,7 +28,14 @@ void PBDSystem::awake(EntityId id)
 
 void PBDSystem::start()
 {
-      
+      // particles which left the system leave the grid once per frame, a member got re-added under a recycled id
+      auto leaveGrid = [this](std::span<const EntityId> entities) {
+            for (EntityId entity : entities)
+                  if (!m_entities.contains(entity))
+                        m_grid.remove_particle(entity);
+      };
+      m_ecs->on_remove<PBDParticle>(leaveGrid);
+      m_ecs->on_remove<Transform>(leaveGrid);
 }
 void PBDSystem::update(float dt)
 {
@@ -46,7 +58,8 @@ void PBDSystem::pbd_update(float dt)
             particle.oldPosition = particle.position;
       }
 
-      damp_velocities();
+      for (EntityId entity : m_entities)
+            get_particle(entity).velocity *= m_dampingConstant;
 
       for (EntityId entity : m_entities)
       {
@@ -84,6 +97,16 @@ void PBDSystem::xpbd_update(float dt)
       generate_constraints();
       logger::log("generate constraints", m_profiler.end_measure("gen const"));
 
+      // the components are only touched here and in the scatter, the substeps work on the store
+      m_store.gather(m_ecs, m_entities.dense());
+      m_resolvedConstraints.resize(m_constraints.size());
+      for (size_t i = 0; i < m_constraints.size(); i++)
+            m_resolvedConstraints[i] = m_constraints[i]->resolve(m_store);
+      for (auto& batch : m_constraintBatches)
+            batch->resolve(m_store);
+      if (m_solverMode == PBDSolverMode::GraphColoring)
+            color_constraints();
+
       m_profiler.start_measure("substeps");
 
       for (int substep = 0; substep < m_substeps; substep++)
@@ -92,41 +115,34 @@ void PBDSystem::xpbd_update(float dt)
       }
 
       logger::log("substeps", m_profiler.end_measure("substeps"));
+
+      m_store.scatter();
+      // the substeps never query the grid, update_neighbors moves the particles it needs, this is for draw_debug_lines
+      sync_store_grid();
 }
 void PBDSystem::xpbd_substep(float dt)
 {
-      for (EntityId entity : m_entities)
-      {
-            auto& particle = get_particle(entity);
-            particle.scale = m_ecs->get_component<Transform>(entity).scale;
-
-            if (particle.invmass != 0)
-                  particle.invmass = 1.f / particle.mass;
-            particle.velocity += dt * particle.invmass * external_force(particle.position);
+      const size_t count = m_store.size();
+      Vec* positions = m_store.m_positions.data();
+      Vec* predicted = m_store.m_predicted.data();
+      Vec* velocities = m_store.m_velocities.data();
+      const float* invMasses = m_store.m_invMasses.data();
 
-            particle.tempPosition = particle.position;
-            particle.oldPosition = particle.position;
+      for (size_t i = 0; i < count; i++)
+      {
+            velocities[i] += dt * invMasses[i] * external_force(predicted[i]);
+            positions[i] = predicted[i];
       }
 
       damp_velocities();
 
-      for (EntityId entity : m_entities)
-      {
-            auto& particle = get_particle(entity);
-            particle.position = particle.position + dt * particle.velocity;
-
-            sync_grid(particle, entity);
-      }
+      for (size_t i = 0; i < count; i++)
+            predicted[i] = positions[i] + dt * velocities[i];
 
       xpbd_solve(dt);
 
-      for (EntityId entity : m_entities)
-      {
-            auto& particle = get_particle(entity);
-            particle.velocity = (particle.position - particle.oldPosition) / dt;
-      
-            sync_grid(particle, entity);
-      }
+      for (size_t i = 0; i < count; i++)
+            velocities[i] = (predicted[i] - positions[i]) / dt;
 
       velocity_update();
 }
@@ -135,6 +151,17 @@ void PBDSystem::register_self_generating_constraint(ConstraintGenerator* generat
 {
       m_constraintGenerators.emplace_back(generator);
 }
+void PBDSystem::set_threads(int threads)
+{
+      m_grid.set_threads(threads);
+      if (threads <= 1)
+      {
+            m_threadPool.reset();
+            return;
+      }
+      m_threadPool = std::make_unique<ThreadPool>();
+      m_threadPool->initialize(threads);
+}
 
 // ---------------------------------------
 // PRIVATE MEHODS
@@ -143,11 +170,8 @@ void PBDSystem::register_self_generating_constraint(ConstraintGenerator* generat
 
 void PBDSystem::damp_velocities()
 {
-      for (auto e : m_entities)
-      {
-            auto& p = get_particle(e);
-            p.velocity *= m_dampingConstant;
-      }
+      for (Vec& velocity : m_store.m_velocities)
+            velocity *= m_dampingConstant;
 
 //      float massSum = 0.f; for (auto e : m_entities) massSum += get_particle(e).mass;
 //
@@ -221,32 +245,38 @@ void PBDSystem::velocity_update()
 }
 void PBDSystem::generate_constraints()
 {
-      // clear collision constraints
-      m_constraints.erase(m_constraints.begin() + m_constraintStart, m_constraints.end());
+      // clear collision constraints, the pools keep them for this frame's
+      m_constraints.resize(m_constraintStart);
+      m_constraintColors.resize(std::min(m_constraintColors.size(), m_constraintStart));
+      for (auto& pool : m_constraintPools)
+            if (pool)
+                  pool->clear();
+      for (auto& batch : m_constraintBatches)
+            batch->clear();
 
       m_constraintStart = m_constraints.size();
 
+      update_neighbors();
+
       float avgNeighbors{ 0.f };
 
-      std::vector<EntityId> unfilteredSurroundingParticles;
+      const auto& entities = m_entities.dense();
       std::vector<EntityId> surroundingParticles;
-      std::sort(m_entities.begin(), m_entities.end());
       #pragma omp parallel default(shared)
       {
             #pragma omp for schedule(static)
-            for (EntityId entity : m_entities)
+            for (size_t row = 0; row < entities.size(); row++)
             {
+                  EntityId entity = entities[row];
                   const auto& particle = get_particle(entity);
                   if (particle.radius == 0)
                         continue;
 
+                  // the rows reach further than the constraints, by the skin
                   surroundingParticles.clear();
-                  unfilteredSurroundingParticles.clear();
-
-                  m_grid.surrounding_particles(particle.position, unfilteredSurroundingParticles);
                   std::copy_if(
-                        unfilteredSurroundingParticles.begin(),
-                        unfilteredSurroundingParticles.end(),
+                        m_neighbors.begin() + m_neighborStart[row],
+                        m_neighbors.begin() + m_neighborStart[row + 1],
                         std::back_inserter(surroundingParticles),
                         [&](EntityId e) {
                               Vec d = get_particle(e).position - particle.position;
@@ -259,16 +289,68 @@ void PBDSystem::generate_constraints()
                   //      m_ecs->m_renderer->gizmos_draw_line(get_particle(entity).position, get_particle(e).position, Color(1.f), 0.05f);
 
                   for (const auto constraintGenerator : m_constraintGenerators)
-                  {
-                        auto constraints = constraintGenerator->create(entity, surroundingParticles, m_ecs);
-                        m_constraints.insert(m_constraints.end(), constraints.cbegin(), constraints.cend());
-                  }
+                        constraintGenerator->create(entity, surroundingParticles, m_ecs, *this);
             }
       }
 
       avgNeighbors /= static_cast<float>(m_entities.size());
       logger::log("average neighbors", avgNeighbors);
 }
+void PBDSystem::update_neighbors()
+{
+      if (!neighbors_outdated())
+            return;
+
+      const auto& entities = m_entities.dense();
+      const float reach = PBD_GRID_SIZE + m_neighborSkin;
+      const size_t count = entities.size();
+
+      m_neighborEntities = entities;
+      m_neighborBuildSkin = m_neighborSkin;
+      m_neighborPositions.resize(count);
+      for (size_t row = 0; row < count; row++)
+      {
+            m_neighborPositions[row] = m_ecs->read_component<PBDParticle>(entities[row]).position;
+            m_grid.move_particle(m_neighborPositions[row], entities[row]);
+      }
+
+      // rows are counted and then filled, every query writes only its own row
+      m_neighborStart.assign(count + 1, 0);
+      m_grid.for_each_in_radius(std::span<const Vec>(m_neighborPositions), reach, [this](size_t row, EntityId neighbor, float sqrDistance) {
+            m_neighborStart[row + 1]++;
+      });
+      for (size_t row = 0; row < count; row++)
+            m_neighborStart[row + 1] += m_neighborStart[row];
+
+      m_neighbors.resize(m_neighborStart.back());
+      m_grid.for_each_in_radius(std::span<const Vec>(m_neighborPositions), reach, [this](size_t row, EntityId neighbor, float sqrDistance) {
+            // the row's start moves along, afterwards it is where the next row starts
+            m_neighbors[m_neighborStart[row]++] = neighbor;
+      });
+      for (size_t row = count; row > 0; row--)
+            m_neighborStart[row] = m_neighborStart[row - 1]; // back to the starts
+      m_neighborStart.front() = 0;
+
+      // the generators get their neighbors in ascending order, like from surrounding_particles
+      for (size_t row = 0; row < count; row++)
+            std::sort(m_neighbors.begin() + m_neighborStart[row], m_neighbors.begin() + m_neighborStart[row + 1]);
+      logger::log("neighbor lists rebuilt", m_neighbors.size());
+}
+bool PBDSystem::neighbors_outdated()
+{
+      if (m_neighborBuildSkin != m_neighborSkin || m_entities.dense() != m_neighborEntities)
+            return true;
+
+      // two particles which each moved less than half the skin can't have closed in by more than the skin
+      const float limit = m_neighborSkin * .5f;
+      for (size_t row = 0; row < m_neighborEntities.size(); row++)
+      {
+            Vec d = m_ecs->read_component<PBDParticle>(m_neighborEntities[row]).position - m_neighborPositions[row];
+            if (glm::dot(d, d) > limit * limit)
+                  return true;
+      }
+      return false;
+}
 void PBDSystem::solve_constraints()
 {
       solve_seidel_gauss();
@@ -280,103 +362,140 @@ void PBDSystem::solve_seidel_gauss()
 }
 void PBDSystem::xpbd_solve(float dt)
 {
-      std::vector<Vec> deltas;
+      if (m_solverMode == PBDSolverMode::GraphColoring)
+            solve_colored(dt);
+      else
+            solve_jacobi(dt);
+}
+void PBDSystem::solve_jacobi(float dt)
+{
       std::vector<bool> isConstraint;
 
       for (int i = 0; i < m_solverIterations; i++)
       {
             isConstraint.resize(m_constraints.size());
             // project constraints
-            //#pragma omp parallel default(shared)
+            for (size_t constraintIndex = 0; constraintIndex < m_constraints.size(); constraintIndex++)
             {
-                  //#pragma omp for schedule(static)
-                  for (size_t constraintIndex = 0; constraintIndex < m_constraints.size(); constraintIndex++)
-                  {
-                        Constraint* constraint = m_constraints[constraintIndex];
-
-                        isConstraint[constraintIndex] = false;
-
-                        constraint->m_gradients.clear();
-                        constraint->m_gradients.reserve(constraint->m_entities.size());
-                        for (size_t j = 0; j < constraint->m_particles.size(); j++)
-                              constraint->m_gradients.push_back(constraint->constraint_gradient(j, constraint->m_particles));
-
-                        float constraintErr = constraint->constraint(constraint->m_particles);
-
-                        if (
-                              constraint->m_type == Inequality && constraintErr >= 0
-                              || constraint->m_type == InverseInequality && constraintErr <= 0
-                              )
-                              continue;
-
-                        // calculate the overall constraint gradient
-
-                        float sqrGradientSum = 0;
-                        Vec gradientSum{ 0.f };
-                        for (size_t j = 0; j < constraint->m_particles.size(); j++)
-                        {
-                              gradientSum += constraint->m_gradients[j];
-                              sqrGradientSum +=
-                                    constraint->m_particles[j]->invmass
-                                    * glm::dot(constraint->m_gradients[j], constraint->m_gradients[j]);
-                        }
-
-                        sqrGradientSum += glm::dot(gradientSum, gradientSum);
-                        sqrGradientSum += constraint->m_compliance / std::powf(dt, 2.f);
-
-                        if (sqrGradientSum == 0.f)
-                              continue;
-
-                        float scalingFactor = constraintErr / (sqrGradientSum + .000001f);
-                        if (scalingFactor != scalingFactor)
-                              continue;
+                  isConstraint[constraintIndex] = m_resolvedConstraints[constraintIndex]
+                        && constraint_scaling(m_constraints[constraintIndex], m_constraints[constraintIndex]->particles(m_store), dt);
+            }
+            for (auto& batch : m_constraintBatches)
+                  batch->compute(m_store, dt);
 
-                        constraint->m_scalingFactor = scalingFactor;
-                        isConstraint[constraintIndex] = true;
-                  }
+            for (size_t constraintIndex = 0; constraintIndex < m_constraints.size(); constraintIndex++)
+            {
+                  if (!isConstraint[constraintIndex])
+                        continue;
+                  Constraint* constraint = m_constraints[constraintIndex];
+                  apply_constraint(constraint, constraint->particles(m_store));
             }
+            for (auto& batch : m_constraintBatches)
+                  batch->apply(m_store);
+      }
+}
+void PBDSystem::solve_colored(float dt)
+{
+      const size_t serialColor = PBD_SOLVER_MAX_COLORS;
 
-            //#pragma omp parallel default(shared)
+      for (int i = 0; i < m_solverIterations; i++)
+      {
+            // the constraints of one color write distinct particles, the colors are solved one after another
+            for (size_t color = 0; color < serialColor; color++)
             {
-                  //#pragma omp for schedule(static)
-                  for (size_t constraintIndex = 0; constraintIndex < m_constraints.size(); constraintIndex++)
+                  uint32_t start = m_colorStart[color];
+                  uint32_t end = m_colorStart[color + 1];
+                  if (!m_threadPool || end - start <= PBD_SOLVER_JOB_SIZE)
                   {
-                        if (!isConstraint[constraintIndex])
-                              continue;
-                        Constraint* constraint = m_constraints[constraintIndex];
-
-                        // calculate delta
-                        //Vec delta{ 0.f };
-                        //for (size_t j = 0; j < constraint->m_particles.size(); j++)
-                        //{
-                        //      delta +=
-                        //            -(constraint->m_scalingFactor) // +particles[j]->scalingFactor)
-                        //            * constraint->m_particles[j]->invmass
-                        //            * constraint->m_gradients[j];
-
-                        //      if (constraint->m_particles[1]->position != Vec(0.f))
-                        //      {
-                        //            if (j == 0)
-                        //                  logger::log("scalingFactor: ", constraint->m_scalingFactor);
-                        //            logger::log("gradient: ", constraint->m_gradients[j]);
-                        //            logger::log("invmass: ", constraint->m_particles[j]->invmass);
-                        //      }
-                        //}
-                        //if (constraint->m_particles[1]->position != Vec(0.f))
-                        //      logger::log("-----------------------------------------------------------");
-                        for (size_t pIndex = 0; pIndex < constraint->m_particles.size(); pIndex++)
-                        {
-                              Vec delta = 
-                                    -(constraint->m_scalingFactor)
-                                    * constraint->m_particles[pIndex]->invmass
-                                    * constraint->m_gradients[pIndex];
-                              
-                              constraint->m_particles[pIndex]->position += delta;
-                        }
+                        solve_colored_range(start, end, dt);
+                        continue;
+                  }
+                  for (uint32_t job = start; job < end; job += PBD_SOLVER_JOB_SIZE)
+                  {
+                        uint32_t jobEnd = std::min(end, job + PBD_SOLVER_JOB_SIZE);
+                        m_threadPool->doJob([this, job, jobEnd, dt]() { solve_colored_range(job, jobEnd, dt); });
                   }
+                  m_threadPool->wait_for_finish();
             }
+            solve_colored_range(m_colorStart[serialColor], m_colorStart[serialColor + 1], dt);
+      }
+}
+void PBDSystem::solve_colored_range(uint32_t start, uint32_t end, float dt)
+{
+      // a color lists the virtual constraints and then the ones of every batch, all in ascending order
+      const uint32_t* order = m_colorOrder.data();
+      uint32_t i = start;
+      for (; i < end && order[i] < m_batchStart.front(); i++)
+      {
+            Constraint* constraint = m_constraints[order[i]];
+            InParticles particles = constraint->particles(m_store);
+            if (constraint_scaling(constraint, particles, dt))
+                  apply_constraint(constraint, particles);
+      }
+      for (size_t batch = 0; batch < m_constraintBatches.size() && i < end; batch++)
+      {
+            uint32_t batchEnd = static_cast<uint32_t>(std::lower_bound(order + i, order + end, m_batchStart[batch + 1]) - order);
+            if (batchEnd > i)
+                  m_constraintBatches[batch]->project(m_store, order + i, batchEnd - i, m_batchStart[batch], dt);
+            i = batchEnd;
       }
 }
+bool PBDSystem::constraint_scaling(Constraint* constraint, InParticles particles, float dt)
+{
+      constraint->m_gradients.clear();
+      constraint->m_gradients.reserve(particles.size());
+      for (size_t j = 0; j < particles.size(); j++)
+            constraint->m_gradients.push_back(constraint->constraint_gradient(j, particles));
+
+      float constraintErr = constraint->constraint(particles);
+
+      return xpbd_scaling_factor(
+            constraint->m_type, constraintErr, particles, constraint->m_gradients.data(),
+            constraint->m_compliance, dt, constraint->m_scalingFactor
+      );
+}
+void PBDSystem::apply_constraint(Constraint* constraint, InParticles particles)
+{
+      xpbd_apply(particles, constraint->m_gradients.data(), constraint->m_scalingFactor);
+}
+void PBDSystem::color_constraints()
+{
+      const size_t count = m_constraints.size();
+      m_constraintColors.resize(count, PBD_SOLVER_NO_COLOR);
+      m_particleColors.assign(m_store.size(), 0);
+      auto indices = [this](size_t i) { return std::span<const uint32_t>(m_constraints[i]->m_indices); };
+
+      // persistent colors are claimed before any new one is handed out
+      claim_constraint_colors(m_constraintStart, m_resolvedConstraints.data(), m_constraintColors.data(), indices, m_store, m_particleColors.data());
+      for (auto& batch : m_constraintBatches)
+            batch->claim_colors(m_store, m_particleColors.data());
+      assign_constraint_colors(count, m_resolvedConstraints.data(), m_constraintColors.data(), indices, m_store, m_particleColors.data());
+      for (auto& batch : m_constraintBatches)
+            batch->assign_colors(m_store, m_particleColors.data());
+
+      // the virtual constraints are followed by the ones of every batch
+      m_batchStart.resize(m_constraintBatches.size() + 1);
+      m_batchStart.front() = static_cast<uint32_t>(count);
+      for (size_t batch = 0; batch < m_constraintBatches.size(); batch++)
+            m_batchStart[batch + 1] = m_batchStart[batch] + static_cast<uint32_t>(m_constraintBatches[batch]->size());
+
+      // constraint indices grouped by color, in ascending order within a color
+      m_colorStart.assign(PBD_SOLVER_MAX_COLORS + 2, 0);
+      for (size_t i = 0; i < count; i++)
+            if (m_resolvedConstraints[i])
+                  m_colorStart[m_constraintColors[i] + 1]++;
+      for (auto& batch : m_constraintBatches)
+            batch->count_colors(m_colorStart.data() + 1);
+      for (size_t color = 0; color <= PBD_SOLVER_MAX_COLORS; color++)
+            m_colorStart[color + 1] += m_colorStart[color];
+      m_colorOrder.resize(m_colorStart.back());
+      std::vector<uint32_t> cursor(m_colorStart.begin(), m_colorStart.end() - 1);
+      for (size_t i = 0; i < count; i++)
+            if (m_resolvedConstraints[i])
+                  m_colorOrder[cursor[m_constraintColors[i]]++] = static_cast<uint32_t>(i);
+      for (size_t batch = 0; batch < m_constraintBatches.size(); batch++)
+            m_constraintBatches[batch]->order_colors(cursor.data(), m_colorOrder.data(), m_batchStart[batch]);
+}
 void PBDSystem::solve_sys()
 {
 
@@ -399,6 +518,11 @@ void PBDSystem::sync_grid(PBDParticle& particle, EntityId entity)
       m_grid.change_particle(particle.tempPosition, particle.position, entity);
       particle.tempPosition = particle.position;
 }
+void PBDSystem::sync_store_grid()
+{
+      for (size_t i = 0; i < m_store.size(); i++)
+            m_grid.move_particle(m_store.m_predicted[i], m_store.m_entities[i]);
+}
 void PBDSystem::sync_transform()
 {
       for (EntityId entity : m_entities)
@@ -446,15 +570,79 @@ void PBDSystem::draw_debug_lines()
 
 Constraint::Constraint(Cardinality cardinality, std::vector<EntityId> entities, ECSManager* ecs) :
       m_cardinality { cardinality }, m_entities{ entities }, m_compliance{ 0.f }, m_type{ Equality }
+{}
+void Constraint::reset(std::span<const EntityId> entities)
+{
+      m_entities.assign(entities.begin(), entities.end());
+      m_cardinality = entities.size();
+}
+bool Constraint::resolve(const PBDParticleStore& store)
+{
+      m_indices.resize(m_entities.size());
+      for (size_t j = 0; j < m_entities.size(); j++)
+      {
+            m_indices[j] = store.index(m_entities[j]);
+            if (m_indices[j] == PBD_PARTICLE_STORE_NONE)
+                  return false;
+      }
+      return true;
+}
+
+// ---------------------------------------
+// PARTICLE STORE
+// ---------------------------------------
+
+void PBDParticleStore::gather(ECSManager* ecs, const std::vector<EntityId>& entities)
+{
+      for (EntityId entity : m_entities)
+            m_index[entity] = PBD_PARTICLE_STORE_NONE;
+
+      size_t count = entities.size();
+      m_entities = entities;
+      m_components.resize(count);
+      m_positions.resize(count);
+      m_predicted.resize(count);
+      m_velocities.resize(count);
+      m_invMasses.resize(count);
+
+      for (size_t i = 0; i < count; i++)
+      {
+            EntityId entity = entities[i];
+            if (m_index.size() <= entity)
+                  m_index.resize(static_cast<size_t>(entity) + 1, PBD_PARTICLE_STORE_NONE);
+            m_index[entity] = static_cast<uint32_t>(i);
+
+            auto& particle = ecs->get_component<PBDParticle>(entity);
+            particle.scale = ecs->read_component<Transform>(entity).scale;
+            if (particle.invmass != 0)
+                  particle.invmass = 1.f / particle.mass;
+
+            m_components[i] = &particle;
+            m_positions[i] = particle.position;
+            m_predicted[i] = particle.position;
+            m_velocities[i] = particle.velocity;
+            m_invMasses[i] = particle.invmass;
+      }
+}
+void PBDParticleStore::scatter()
 {
-      for (size_t j = 0; j < entities.size(); j++)
-            m_particles.push_back(&ecs->get_component<PBDParticle>(entities[j]));
+      for (size_t i = 0; i < m_entities.size(); i++)
+      {
+            auto& particle = *m_components[i];
+            particle.oldPosition = m_positions[i];
+            particle.tempPosition = m_predicted[i];
+            particle.position = m_predicted[i];
+            particle.velocity = m_velocities[i];
+      }
 }
 
 // ---------------------------------------
 // COLLISION CONSTRAINT
 // ---------------------------------------
 
+CollisionConstraint::CollisionConstraint() :
+      CollisionConstraint(0.f, {}, nullptr)
+{}
 CollisionConstraint::CollisionConstraint(float distance, std::vector<EntityId> entities, ECSManager* ecs) :
       Constraint(2, entities, ecs), m_distance{ distance }
 {
@@ -482,7 +670,7 @@ float CollisionConstraint::constraint(InParticles particles)
 //#endif
 
       // sphere constraint
-      return glm::length(particles[0]->position - particles[1]->position) - m_distance;
+      return glm::length(particles.position(0) - particles.position(1)) - m_distance;
 }
 Vec CollisionConstraint::constraint_gradient(size_t der, InParticles particles)
 {
@@ -508,53 +696,33 @@ Vec CollisionConstraint::constraint_gradient(size_t der, InParticles particles)
 //      return n * (static_cast<float>(der) * -2.f + 1.f);
 
       // sphere collision
-      Vec d = particles[0]->position - particles[1]->position;
+      Vec d = particles.position(0) - particles.position(1);
       float length = glm::length(d);
       if (length != 0.f)
             d /= length;
       return d * (static_cast<float>(der) * -2.f + 1.f);
 }
 
-std::vector<Constraint*> CollisionConstraintGenerator::create(
-      EntityId particle, std::vector<EntityId> surrounding,
-      ECSManager* ecs
+void CollisionConstraintGenerator::create(
+      EntityId particle, const std::vector<EntityId>& surrounding,
+      ECSManager* ecs, PBDSystem& system
 )
 {
-      std::vector<Constraint*> constraints;
       const auto& pbdParticle = ecs->get_component<PBDParticle>(particle);
+      auto& collisions = system.constraint_batch<CollisionKind, 2>();
 
-      #pragma omp parallel default(shared)
+      for (const auto& surroundingParticle : surrounding)
       {
-            #pragma omp for schedule(static)
-            for (const auto& surroundingParticle : surrounding)
-            {
-                  if (particle >= surroundingParticle)
-                        continue;
-
-                  const auto& other = ecs->get_component<PBDParticle>(surroundingParticle);
-                  if (other.radius == 0)
-                        continue;
-
-                  auto constraint = new CollisionConstraint(
-                        pbdParticle.radius + other.radius,
-                        { particle, surroundingParticle },
-                        ecs
-                  );
-                  constraint->m_compliance = 0.f;
-                  constraint->m_type = Inequality;
+            if (particle >= surroundingParticle)
+                  continue;
 
-                  auto fluidConstraint = new CollisionConstraint(
-                        (pbdParticle.radius + other.radius) * 2.f,
-                        { particle, surroundingParticle },
-                        ecs
-                  );
-                  fluidConstraint->m_compliance = 2.f;
-                  fluidConstraint->m_type = InverseInequality;
+            const auto& other = ecs->get_component<PBDParticle>(surroundingParticle);
+            if (other.radius == 0)
+                  continue;
 
-                  constraints.emplace_back(constraint);
-                  constraints.emplace_back(fluidConstraint);
-            }
+            const EntityId pair[] = { particle, surroundingParticle };
+            float distance = pbdParticle.radius + other.radius;
+            collisions.add(pair, { distance }, Inequality, 0.f);
+            collisions.add(pair, { distance * 2.f }, InverseInequality, 2.f);
       }
-
-      return constraints;
-}
+}
\ No newline at end of file
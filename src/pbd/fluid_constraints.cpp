@@ -182,6 +182,9 @@ float density_to_pressure(float density)
 // PUBLIC METHODS
 // ---------------------------------
 
+SPHConstraint::SPHConstraint() :
+      SPHConstraint({}, nullptr)
+{}
 SPHConstraint::SPHConstraint(std::vector<EntityId> entities, ECSManager* ecs) :
       Constraint(entities.size(), entities, ecs)
 {
@@ -196,7 +199,7 @@ float SPHConstraint::constraint(InParticles particles)
       // return density_to_pressure(particles.front()->density);
       // return std::max(particles.front()->density / BaseDensity - 1.f, 0.f);
 
-      return density_to_pressure(particles.front()->density / BaseDensity);
+      return density_to_pressure(particles.component(0).density / BaseDensity);
 }
 // returns the influence gradient
 Vec SPHConstraint::constraint_gradient(size_t der, InParticles particles)
@@ -204,25 +207,38 @@ Vec SPHConstraint::constraint_gradient(size_t der, InParticles particles)
       if (der == 0)
             return Vec(0.f);
       return
-            (density_to_pressure(particles.front()->density) + density_to_pressure(particles[der]->density)) *
-            //density_to_pressure(particles.front()->density) *
-            kernel_gradient(particles[der]->position - particles.front()->position)
+            (density_to_pressure(particles.component(0).density) + density_to_pressure(particles.component(der).density)) *
+            //density_to_pressure(particles.component(0).density) *
+            kernel_gradient(particles.position(der) - particles.position(0))
             / BaseDensity
-            * particles[der]->fluidMass;
+            * particles.component(der).fluidMass;
+}
+
+float SPHDensityKind::evaluate(const BatchParticles<PBD_DYNAMIC_ARITY>& particles, const Params& params, Vec* gradients)
+{
+      float pressure = density_to_pressure(particles.component(0).density);
+      gradients[0] = Vec(0.f);
+      for (size_t der = 1; der < particles.size(); der++)
+      {
+            gradients[der] =
+                  (pressure + density_to_pressure(particles.component(der).density)) *
+                  kernel_gradient(particles.position(der) - particles.position(0))
+                  / BaseDensity
+                  * particles.component(der).fluidMass;
+      }
+      return density_to_pressure(particles.component(0).density / BaseDensity);
 }
 
 // ---------------------------------
 // CONSTRAINT GENERATOR
 // ---------------------------------
-std::vector<Constraint*> SPHConstraintGenerator::create(
-      EntityId particle, std::vector<EntityId> surrounding,
-      ECSManager* ecs
+void SPHConstraintGenerator::create(
+      EntityId particle, const std::vector<EntityId>& surrounding,
+      ECSManager* ecs, PBDSystem& system
 )
 {
-      std::vector<Constraint*> constraints;
-
       if (surrounding.size() <= 1)
-            return constraints;
+            return;
 
       auto& pbdParticle = ecs->get_component<PBDParticle>(particle);
 
@@ -246,12 +262,10 @@ std::vector<Constraint*> SPHConstraintGenerator::create(
             }
       }
 
-      surrounding.insert(surrounding.begin(), particle);
-      auto constraint = new SPHConstraint(
-            surrounding, ecs
-      );
-
-      constraints.emplace_back(constraint);
+      m_particles.clear();
+      m_particles.push_back(particle);
+      m_particles.insert(m_particles.end(), surrounding.begin(), surrounding.end());
+      system.constraint_batch<SPHDensityKind, PBD_DYNAMIC_ARITY>().add(m_particles, {}, Equality, 0.f);
 
       //for (const auto& surroundingParticle : surrounding)
       //{
@@ -260,14 +274,10 @@ std::vector<Constraint*> SPHConstraintGenerator::create(
 
       //      const auto& other = ecs->get_component<PBDParticle>(surroundingParticle);
 
-      //      auto constraint = new SPHConstraint(
+      //      auto& constraint = system.emplace_constraint<SPHConstraint>(
       //            { particle, surroundingParticle }
       //      );
-      //      constraint->m_stiffness = 1.f;
-      //      constraint->m_type = Equality;
-
-      //      constraints.emplace_back(constraint);
+      //      constraint.m_stiffness = 1.f;
+      //      constraint.m_type = Equality;
       //}
-
-      return constraints;
 }
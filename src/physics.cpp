@@ -76,7 +76,7 @@ Vector3 PhysicsSystem::calc_acc(EntityId entity, Vector3 pos)
 	Vector3 acc = { 0,0,0 };
 
 	// collision with other rigidbody
-	for (auto b = std::find(m_entities.begin(), m_entities.end(), entity) + 1; b != m_entities.end(); b++)
+	for (auto b = m_entities.begin() + m_entities.index(entity) + 1; b != m_entities.end(); b++)
 	{
 		if (!colliding(entity, *b) || entity == *b)
 			continue;
@@ -133,17 +133,17 @@ Transform& PhysicsSystem::get_transform(EntityId entity)
 
 void PhysicsSystem::sync_transform()
 {
-	for (EntityId entity : m_entities)
+	m_ecs->each<Transform, Rigidbody>([](Transform& transform, Rigidbody& rb)
 	{
-		sync_transform(entity);
-	}
+		transform.position = rb.pos;
+	});
 }
 void PhysicsSystem::sync_rigidbody()
 {
-	for (EntityId entity : m_entities)
+	m_ecs->each<Transform, Rigidbody>([](Transform& transform, Rigidbody& rb)
 	{
-		sync_rigidbody(entity);
-	}
+		rb.pos = transform.position;
+	});
 }
 void PhysicsSystem::sync_transform(EntityId entity)
 {
@@ -59,6 +59,9 @@ void Renderer::init(RenderConfig config)
       m_firstFrame = true;
       m_initialized = true;
 
+      m_ecs.set_storage_mode(config.ecsStorageMode);
+      m_ecs.set_system_threads(config.ecsSystemThreads);
+
       // add_descriptors();
 
       glfwInit();
@@ -247,11 +250,34 @@ EntityId Renderer::create_empty_game_object()
 }
 EntityId Renderer::create_default_model(DefaultModel::DefaultModel defaultModel)
 {
-      const auto entity = create_empty_game_object();
-      auto& model = m_ecs.add_component<DynamicModel>(entity);
-      model.load_mesh(s_defaultModelToPath[defaultModel]);
+      const auto entity = m_ecs.instantiate(default_model_prefab(defaultModel));
+
+      // own materials and shaders like a freshly loaded model, so the hash has to be recomputed
+      auto& model = m_ecs.get_component<DynamicModel>(entity);
+      for (auto& mesh : model.m_children)
+      {
+            mesh.material = std::make_shared<Material>(*mesh.material);
+            mesh.material->m_shader = make_default_shader();
+      }
+      model.hashSum = 0;
       return entity;
 }
+PrefabId Renderer::default_model_prefab(DefaultModel::DefaultModel defaultModel)
+{
+      auto it = m_defaultModelPrefabs.find(defaultModel);
+      if (it != m_defaultModelPrefabs.end())
+            return it->second;
+
+      DynamicModel model;
+      model.load_mesh(s_defaultModelToPath[defaultModel]);
+      Prefab prefab;
+      prefab.set<Transform>(Transform());
+      prefab.set<DynamicModel>(shared_mesh_model(model));
+
+      PrefabId id = m_ecs.register_prefab(std::move(prefab));
+      m_defaultModelPrefabs.emplace(defaultModel, id);
+      return id;
+}
 
 void Renderer::reload_pipelines()
 {
@@ -327,6 +353,8 @@ void Renderer::initialize_geometry_handlers()
       }
       set_geometry_handler_subpasses();
 
+      // before the geometry handlers, which upload the world transforms it computes
+      m_ecs.register_system<TransformHierarchy>(&m_transformHierarchy);
       m_ecs.register_system<StaticGeometryHandler>(&m_staticGeometryHandler);
       m_ecs.register_system<DynamicGeometryHandler>(&m_dynamicGeometryHandler);
       m_ecs.register_system<GizmosHandler>(&m_gizmosHandler);
@@ -99,7 +99,7 @@ void SimpleFluid::update(float dt)
 			bucket.erase(std::find(bucket.begin(), bucket.end(), &particle));
 
 			m_availableParticleIndices.push(particle.index);
-			m_ecs->delete_entity(particleId);
+			m_ecs->commands().delete_entity(particleId);
 		}
 	}
 
@@ -3,47 +3,63 @@
 #include <math.h>
 
 #include <algorithm>
+#include <bit>
 
 #include "logger.h"
 
-SpatialHashGrid::SpatialHashGrid(float gridSize) :
-      m_gridSize{ gridSize }
+SpatialHashGrid::SpatialHashGrid(float gridSize, SpatialHashGridMode mode) :
+      m_gridSize{ gridSize }, m_mode{ mode }, m_cellCount{ SPATIAL_HASH_GRID_MIN_CELLS }, m_compactDirty{ true }, m_threads{ 1 }
 {
-      m_buckets.resize(100*100*10);
+      if (m_mode == SpatialHashGridMode::Buckets)
+            m_buckets.resize(100*100*10);
 }
 
-size_t SpatialHashGrid::hash_vec(Vector3 v)
+size_t SpatialHashGrid::hash_vec(Vector3 v, size_t tableSize)
 {
-      return ((
-            (static_cast<int64_t>(std::floor(v.x / m_gridSize)) * 73856093)
-            ^ (static_cast<int64_t>(std::floor(v.y / m_gridSize)) * 19349663)
-            ^ (static_cast<int64_t>(std::floor(v.z / m_gridSize)) * 83492791)
-            ) % m_buckets.size() + m_buckets.size()) % m_buckets.size();
+      return hash_cell(
+            static_cast<int64_t>(std::floor(v.x / m_gridSize)),
+            static_cast<int64_t>(std::floor(v.y / m_gridSize)),
+            static_cast<int64_t>(std::floor(v.z / m_gridSize)),
+            tableSize
+      );
 }
 size_t SpatialHashGrid::bucket_index(Vector3 v)
 {
-      return hash_vec(v);
+      if (m_mode == SpatialHashGridMode::Compact)
+            return hash_vec(v, m_cellCount);
+      return hash_vec(v, m_buckets.size());
 }
 
-std::vector<EntityId>& SpatialHashGrid::bucket_at(Vector3 pos)
+std::span<const EntityId> SpatialHashGrid::bucket_at(Vector3 pos)
 {
-      return m_buckets[bucket_index(pos)];
+      if (m_mode == SpatialHashGridMode::Buckets)
+            return m_buckets[bucket_index(pos)];
+
+      if (m_compactDirty)
+            rebuild();
+      size_t cell = bucket_index(pos);
+      return { m_sortedEntities.data() + m_cellStart[cell], m_cellStart[cell + 1] - m_cellStart[cell] };
 }
-std::vector<EntityId>& SpatialHashGrid::bucket_at(Vector2 pos)
+std::span<const EntityId> SpatialHashGrid::bucket_at(Vector2 pos)
 {
       return bucket_at(vec23(pos));
 }
 
 void SpatialHashGrid::surrounding_particles(Vector3 pos, std::vector<EntityId>& particles)
 {
-      for (int x = -1; x <= 1; x++)
+      surrounding_particles(pos, m_gridSize, particles);
+}
+void SpatialHashGrid::surrounding_particles(Vector3 pos, float radius, std::vector<EntityId>& particles)
+{
+      int cells = std::max(1, static_cast<int>(std::ceil(radius / m_gridSize)));
+      for (int x = -cells; x <= cells; x++)
       {
-            for (int y = -1; y <= 1; y++)
+            for (int y = -cells; y <= cells; y++)
             {
-                  for (int z = -1; z <= 1; z++)
+                  for (int z = -cells; z <= cells; z++)
                   {
-                        const auto& bucket = bucket_at(pos + Vector3 { x, y, z } * m_gridSize);
-                        particles.insert(particles.end(), bucket.cbegin(), bucket.cend());
+                        auto bucket = bucket_at(pos + Vector3 { x, y, z } * m_gridSize);
+                        particles.insert(particles.end(), bucket.begin(), bucket.end());
                   }
             }
       }
@@ -63,16 +79,48 @@ void SpatialHashGrid::surrounding_particles(Vector2 pos, std::vector<EntityId>&
             {
                   if (dim == 2 && sign == 1)
                         break;
-                  const auto& bucket = bucket_at(pos + m_gridSize * Vector2 { (dim == 0) * sign, (dim == 1) * sign });
-                  particles.insert(particles.end(), bucket.cbegin(), bucket.cend());
+                  auto bucket = bucket_at(pos + m_gridSize * Vector2 { (dim == 0) * sign, (dim == 1) * sign });
+                  particles.insert(particles.end(), bucket.begin(), bucket.end());
             }
       }
-      const auto& bucket = bucket_at(pos);
-      particles.insert(particles.end(), bucket.cbegin(), bucket.cend());
+      auto bucket = bucket_at(pos);
+      particles.insert(particles.end(), bucket.begin(), bucket.end());
+}
+void SpatialHashGrid::surrounding_particles(Vector2 pos, float radius, std::vector<EntityId>& particles)
+{
+      int cells = std::max(1, static_cast<int>(std::ceil(radius / m_gridSize)));
+      for (int x = -cells; x <= cells; x++)
+      {
+            for (int y = -cells; y <= cells; y++)
+            {
+                  auto bucket = bucket_at(pos + Vector2 { x, y } * m_gridSize);
+                  particles.insert(particles.end(), bucket.begin(), bucket.end());
+            }
+      }
+
+      std::sort(particles.begin(), particles.end());
+      particles.erase(std::unique(particles.begin(), particles.end()), particles.end());
 }
 void SpatialHashGrid::insert_particle(Vector3 pos, EntityId id)
 {
-      bucket_at(pos).push_back(id);
+      if (m_mode == SpatialHashGridMode::Compact)
+      {
+            compact_set(pos, id);
+            return;
+      }
+
+      // a recycled entity id may still be inserted
+      remove_particle(id);
+
+      size_t bucket = bucket_index(pos);
+      m_buckets[bucket].push_back(id);
+      if (m_particleBuckets.size() <= id)
+      {
+            m_particleBuckets.resize(static_cast<size_t>(id) + 1, SPATIAL_HASH_GRID_NO_BUCKET);
+            m_particlePositions.resize(static_cast<size_t>(id) + 1);
+      }
+      m_particleBuckets[id] = bucket;
+      m_particlePositions[id] = pos;
 }
 void SpatialHashGrid::insert_particle(Vector2 pos, EntityId id)
 {
@@ -81,8 +129,17 @@ void SpatialHashGrid::insert_particle(Vector2 pos, EntityId id)
 
 void SpatialHashGrid::change_particle(Vector3 oldPos, Vector3 newPos, EntityId id)
 {
+      if (m_mode == SpatialHashGridMode::Compact)
+      {
+            compact_set(newPos, id);
+            return;
+      }
       if (bucket_index(oldPos) == bucket_index(newPos))
+      {
+            if (id < m_particlePositions.size())
+                  m_particlePositions[id] = newPos;
             return;
+      }
       remove_particle(oldPos, id);
       insert_particle(newPos, id);
 }
@@ -91,14 +148,163 @@ void SpatialHashGrid::change_particle(Vector2 oldPos, Vector2 newPos, EntityId i
       change_particle(vec23(oldPos), vec23(newPos), id);
 }
 
+void SpatialHashGrid::move_particle(Vector3 pos, EntityId id)
+{
+      if (m_mode == SpatialHashGridMode::Compact)
+      {
+            compact_set(pos, id);
+            return;
+      }
+      if (id < m_particleBuckets.size() && m_particleBuckets[id] == bucket_index(pos))
+      {
+            m_particlePositions[id] = pos;
+            return;
+      }
+      insert_particle(pos, id);
+}
+void SpatialHashGrid::move_particle(Vector2 pos, EntityId id)
+{
+      move_particle(vec23(pos), id);
+}
+
 void SpatialHashGrid::remove_particle(Vector3 pos, EntityId id)
 {
-      std::erase(bucket_at(pos), id);
+      if (m_mode == SpatialHashGridMode::Compact)
+      {
+            remove_particle(id);
+            return;
+      }
+      std::erase(m_buckets[bucket_index(pos)], id);
+      if (id < m_particleBuckets.size())
+            m_particleBuckets[id] = SPATIAL_HASH_GRID_NO_BUCKET;
 }
 void SpatialHashGrid::remove_particle(Vector2 pos, EntityId id)
 {
       remove_particle(vec23(pos), id);
 }
+void SpatialHashGrid::remove_particle(EntityId id)
+{
+      if (m_mode == SpatialHashGridMode::Compact)
+      {
+            if (id >= m_compactSlots.size() || m_compactSlots[id] == SPATIAL_HASH_GRID_NO_SLOT)
+                  return;
+            // the last particle takes the slot
+            uint32_t slot = m_compactSlots[id];
+            m_compactEntities[slot] = m_compactEntities.back();
+            m_compactPositions[slot] = m_compactPositions.back();
+            m_compactSlots[m_compactEntities[slot]] = slot;
+            m_compactEntities.pop_back();
+            m_compactPositions.pop_back();
+            m_compactSlots[id] = SPATIAL_HASH_GRID_NO_SLOT;
+            m_compactDirty = true;
+            return;
+      }
+      if (id >= m_particleBuckets.size() || m_particleBuckets[id] == SPATIAL_HASH_GRID_NO_BUCKET)
+            return;
+      std::erase(m_buckets[m_particleBuckets[id]], id);
+      m_particleBuckets[id] = SPATIAL_HASH_GRID_NO_BUCKET;
+}
+
+void SpatialHashGrid::rebuild()
+{
+      if (m_mode != SpatialHashGridMode::Compact)
+            return;
+      m_compactDirty = false;
+
+      size_t count = m_compactEntities.size();
+      m_cellCount = std::max<size_t>(SPATIAL_HASH_GRID_MIN_CELLS, std::bit_ceil(2 * count));
+      m_compactCells.resize(count);
+      m_sortedEntities.resize(count);
+      m_sortedPositions.resize(count);
+
+      // every job counts and later scatters a contiguous range of particles, which keeps the sort stable
+      size_t jobs = m_threadPool ? std::min<size_t>(m_threads, std::max<size_t>(1, count / SPATIAL_HASH_GRID_MIN_JOB)) : 1;
+      size_t jobSize = (count + jobs - 1) / jobs;
+      m_jobCounts.resize(jobs);
+      auto run = [&](auto&& fn) {
+            if (jobs == 1)
+            {
+                  fn(0, 0, count);
+                  return;
+            }
+            for (size_t job = 0; job < jobs; job++)
+            {
+                  size_t start = std::min(count, job * jobSize);
+                  size_t end = std::min(count, start + jobSize);
+                  m_threadPool->doJob([fn, job, start, end]() { fn(job, start, end); });
+            }
+            m_threadPool->wait_for_finish();
+      };
+
+      run([this](size_t job, size_t start, size_t end) { compact_count(job, start, end); });
+
+      // exclusive prefix sum over the cells, within a cell the jobs in order
+      m_cellStart.resize(m_cellCount + 1);
+      uint32_t offset = 0;
+      for (size_t cell = 0; cell < m_cellCount; cell++)
+      {
+            m_cellStart[cell] = offset;
+            for (auto& counts : m_jobCounts)
+            {
+                  uint32_t cellCount = counts[cell];
+                  counts[cell] = offset;
+                  offset += cellCount;
+            }
+      }
+      m_cellStart[m_cellCount] = offset;
+
+      run([this](size_t job, size_t start, size_t end) { compact_scatter(job, start, end); });
+}
+void SpatialHashGrid::set_threads(int threads)
+{
+      m_threads = std::max(threads, 1);
+      if (threads <= 1)
+      {
+            m_threadPool.reset();
+            return;
+      }
+      m_threadPool = std::make_unique<ThreadPool>();
+      m_threadPool->initialize(threads);
+}
+
+void SpatialHashGrid::compact_set(Vector3 pos, EntityId id)
+{
+      if (m_compactSlots.size() <= id)
+            m_compactSlots.resize(static_cast<size_t>(id) + 1, SPATIAL_HASH_GRID_NO_SLOT);
+      uint32_t& slot = m_compactSlots[id];
+      if (slot == SPATIAL_HASH_GRID_NO_SLOT)
+      {
+            slot = static_cast<uint32_t>(m_compactEntities.size());
+            m_compactEntities.push_back(id);
+            m_compactPositions.push_back(pos);
+      }
+      else
+      {
+            m_compactPositions[slot] = pos;
+      }
+      m_compactDirty = true;
+}
+void SpatialHashGrid::compact_count(size_t job, size_t start, size_t end)
+{
+      auto& counts = m_jobCounts[job];
+      counts.assign(m_cellCount, 0);
+      for (size_t i = start; i < end; i++)
+      {
+            uint32_t cell = static_cast<uint32_t>(hash_vec(m_compactPositions[i], m_cellCount));
+            m_compactCells[i] = cell;
+            counts[cell]++;
+      }
+}
+void SpatialHashGrid::compact_scatter(size_t job, size_t start, size_t end)
+{
+      auto& slots = m_jobCounts[job];
+      for (size_t i = start; i < end; i++)
+      {
+            uint32_t slot = slots[m_compactCells[i]]++;
+            m_sortedEntities[slot] = m_compactEntities[i];
+            m_sortedPositions[slot] = m_compactPositions[i];
+      }
+}
 
 void SpatialHashGrid::print_buckets(Vector2 max)
 {
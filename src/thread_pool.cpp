@@ -74,12 +74,6 @@ void ThreadPool::threadEntry(int i)
         job();
         // std::cout << "done doing job\n";
         change_job_count(-1);
-
-        if (!m_activeJobCount || shutdown_)
-        {
-            std::unique_lock<std::mutex> l(m_allFinishedLock);
-            m_allFinished.notify_all();
-        }
     }
 
 }
@@ -93,6 +87,9 @@ void ThreadPool::wait_for_finish()
 }
 void ThreadPool::change_job_count(int delta)
 {
-      std::lock_guard<std::mutex> l(m_activeJobCountMutex);
+      // guarded by the same mutex wait_for_finish waits on, so the last job can't finish unnoticed
+      std::lock_guard<std::mutex> l(m_allFinishedLock);
       m_activeJobCount += delta;
+      if (!m_activeJobCount)
+            m_allFinished.notify_all();
 }
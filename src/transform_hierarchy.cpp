@@ -0,0 +1,201 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+
+// column major rotation matrix, rotates like math::quaternion::rotate
+static glm::mat4 rotation_matrix(const Quaternion& q)
+{
+	glm::mat4 m(1.f);
+	m[0][0] = 1.f - 2.f * (q.y * q.y + q.z * q.z);
+	m[0][1] = 2.f * (q.x * q.y + q.w * q.z);
+	m[0][2] = 2.f * (q.x * q.z - q.w * q.y);
+	m[1][0] = 2.f * (q.x * q.y - q.w * q.z);
+	m[1][1] = 1.f - 2.f * (q.x * q.x + q.z * q.z);
+	m[1][2] = 2.f * (q.y * q.z + q.w * q.x);
+	m[2][0] = 2.f * (q.x * q.z + q.w * q.y);
+	m[2][1] = 2.f * (q.y * q.z - q.w * q.x);
+	m[2][2] = 1.f - 2.f * (q.x * q.x + q.y * q.y);
+	return m;
+}
+// translation * rotation * scale
+static glm::mat4 local_matrix(const Transform& transform)
+{
+	glm::mat4 m = rotation_matrix(transform.rotation);
+	m[0] *= transform.scale.x;
+	m[1] *= transform.scale.y;
+	m[2] *= transform.scale.z;
+	m[3] = Vector4(transform.position, 1.f);
+	return m;
+}
+
+WorldTransform compose_world_transform(const WorldTransform& parent, const Transform& local)
+{
+	WorldTransform world;
+	world.matrix = parent.matrix * local_matrix(local);
+	world.position = Vector3(world.matrix[3]);
+	world.scale = parent.scale * local.scale;
+	Quaternion parentRotation = parent.rotation;
+	world.rotation = parentRotation * local.rotation;
+	return world;
+}
+WorldTransform root_world_transform(const Transform& local)
+{
+	WorldTransform world;
+	world.matrix = local_matrix(local);
+	world.position = local.position;
+	world.scale = local.scale;
+	world.rotation = local.rotation;
+	return world;
+}
+
+TransformHierarchy::TransformHierarchy() : m_tick{ 0 }
+{
+	declare_read<Parent>();
+}
+void TransformHierarchy::update(float dt)
+{
+	uint32_t tick = m_ecs->change_tick();
+
+	// any change in membership or parents recomputes everything
+	bool rebuilt = hierarchy_changed();
+	if (rebuilt)
+		build_order();
+
+	if (!m_threadPool || m_batches.size() <= 1)
+	{
+		update_range(0, static_cast<uint32_t>(m_order.size()), rebuilt);
+	}
+	else
+	{
+		// a batch holds whole root subtrees, so no parent is computed by another job
+		for (auto batch : m_batches)
+			m_threadPool->doJob([this, batch, rebuilt]() { update_range(batch.first, batch.second, rebuilt); });
+		m_threadPool->wait_for_finish();
+	}
+
+	m_tick = tick;
+}
+void TransformHierarchy::set_threads(int threads)
+{
+	if (threads <= 1)
+	{
+		m_threadPool.reset();
+		return;
+	}
+	m_threadPool = std::make_unique<ThreadPool>();
+	m_threadPool->initialize(threads);
+}
+
+bool TransformHierarchy::hierarchy_changed()
+{
+	const auto& entities = m_entities.dense();
+	if (entities != m_orderEntities)
+		return true;
+	for (size_t i = 0; i < entities.size(); i++)
+		if (parent_of(entities[i]) != m_orderParents[i])
+			return true;
+	return false;
+}
+void TransformHierarchy::build_order()
+{
+	const auto& entities = m_entities.dense();
+	uint32_t count = static_cast<uint32_t>(entities.size());
+
+	m_orderEntities = entities;
+	m_orderParents.resize(count);
+
+	// member index of every entity id
+	EntityId maxEntity = count > 0 ? *std::max_element(entities.begin(), entities.end()) : 0;
+	std::vector<uint32_t> memberIndex(static_cast<size_t>(maxEntity) + 1, TRANSFORM_HIERARCHY_NO_PARENT);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		memberIndex[entities[i]] = i;
+		m_orderParents[i] = parent_of(entities[i]);
+	}
+
+	// children of every member in compressed rows, parents which aren't members make their children roots
+	std::vector<uint32_t> parentMember(count, TRANSFORM_HIERARCHY_NO_PARENT);
+	std::vector<uint32_t> childStart(static_cast<size_t>(count) + 1, 0);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		EntityId parent = m_orderParents[i];
+		if (parent != entities[i] && parent <= maxEntity && memberIndex[parent] != TRANSFORM_HIERARCHY_NO_PARENT)
+		{
+			parentMember[i] = memberIndex[parent];
+			childStart[parentMember[i] + 1]++;
+		}
+	}
+	for (uint32_t i = 0; i < count; i++)
+		childStart[i + 1] += childStart[i];
+	std::vector<uint32_t> children(childStart.back());
+	std::vector<uint32_t> childCursor(childStart.begin(), childStart.end() - 1);
+	for (uint32_t i = 0; i < count; i++)
+		if (parentMember[i] != TRANSFORM_HIERARCHY_NO_PARENT)
+			children[childCursor[parentMember[i]]++] = i;
+
+	// depth first from every root, parents always precede their children
+	m_order.clear();
+	m_parentIndex.clear();
+	m_batches.clear();
+	std::vector<uint32_t> orderIndex(count, TRANSFORM_HIERARCHY_NO_PARENT);
+	std::vector<uint32_t> stack;
+	uint32_t batchStart = 0;
+	auto visit = [&](uint32_t root)
+	{
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			uint32_t member = stack.back();
+			stack.pop_back();
+
+			orderIndex[member] = static_cast<uint32_t>(m_order.size());
+			m_order.push_back(entities[member]);
+			m_parentIndex.push_back(member == root ? TRANSFORM_HIERARCHY_NO_PARENT : orderIndex[parentMember[member]]);
+
+			for (uint32_t child = childStart[member]; child < childStart[member + 1]; child++)
+				if (orderIndex[children[child]] == TRANSFORM_HIERARCHY_NO_PARENT)
+					stack.push_back(children[child]);
+		}
+
+		if (m_order.size() - batchStart >= TRANSFORM_HIERARCHY_BATCH_SIZE)
+		{
+			m_batches.emplace_back(batchStart, static_cast<uint32_t>(m_order.size()));
+			batchStart = static_cast<uint32_t>(m_order.size());
+		}
+	};
+	for (uint32_t i = 0; i < count; i++)
+		if (parentMember[i] == TRANSFORM_HIERARCHY_NO_PARENT)
+			visit(i);
+	// members of parent cycles are never reached from a root, the cycle is cut at the first one found
+	for (uint32_t i = 0; i < count; i++)
+		if (orderIndex[i] == TRANSFORM_HIERARCHY_NO_PARENT)
+			visit(i);
+	if (batchStart < m_order.size())
+		m_batches.emplace_back(batchStart, static_cast<uint32_t>(m_order.size()));
+
+	m_world.resize(count);
+	m_dirty.resize(count);
+}
+void TransformHierarchy::update_range(uint32_t start, uint32_t end, bool all)
+{
+	for (uint32_t i = start; i < end; i++)
+	{
+		EntityId entity = m_order[i];
+		uint32_t parent = m_parentIndex[i];
+
+		bool dirty = all || m_ecs->changed_since<Transform>(entity, m_tick) || (parent != TRANSFORM_HIERARCHY_NO_PARENT && m_dirty[parent]);
+		m_dirty[i] = dirty;
+		if (!dirty)
+			continue;
+
+		const Transform& local = m_ecs->read_component<Transform>(entity);
+		m_world[i] = parent == TRANSFORM_HIERARCHY_NO_PARENT ? root_world_transform(local) : compose_world_transform(m_world[parent], local);
+		m_ecs->get_component<WorldTransform>(entity) = m_world[i];
+	}
+}
+EntityId TransformHierarchy::parent_of(EntityId entity)
+{
+	if (!m_ecs->used_components(entity).test(component_type_id<Parent>()))
+		return entity;
+	return m_ecs->read_component<Parent>(entity).entity;
+}